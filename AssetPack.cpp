@@ -0,0 +1,117 @@
+#include "AssetPack.hpp"
+
+#include "data_path.hpp"
+
+#include <array>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+AssetPack::AssetPack(std::string const &filename) : file(filename) {
+	ChunkReader reader(file);
+	ChunkSpan< TocEntry > toc = reader.read< TocEntry >("pak0");
+	ChunkSpan< char > names = reader.read< char >("str0");
+	reader.read< uint8_t >("pad0");
+	size_t dat_offset = reader.offset + 8;
+	ChunkSpan< uint8_t > dat = reader.read< uint8_t >("dat0");
+
+	if (!reader.at_end()) {
+		throw std::runtime_error("Trailing data in asset pack '" + filename + "'");
+	}
+	if (dat_offset % Alignment != 0) {
+		throw std::runtime_error("Packed files in '" + filename + "' are not aligned");
+	}
+
+	entries.reserve(toc.size());
+	for (TocEntry const &e : toc) {
+		if (!(e.name_begin <= e.name_end && e.name_end <= names.size())) {
+			throw std::runtime_error("Invalid name indices in table of contents of '" + filename + "'");
+		}
+		if (!(e.offset <= dat.size() && e.size <= dat.size() - e.offset)) {
+			throw std::runtime_error("Invalid file range in table of contents of '" + filename + "'");
+		}
+		if (e.offset % Alignment != 0) {
+			throw std::runtime_error("Packed file in '" + filename + "' is not aligned");
+		}
+		std::string name(names.begin() + e.name_begin, names.begin() + e.name_end);
+		Entry entry;
+		entry.data = (e.size ? dat.data() + e.offset : nullptr);
+		entry.size = e.size;
+		entry.checksum = e.checksum;
+		if (!entries.emplace(name, entry).second) {
+			throw std::runtime_error("Asset pack '" + filename + "' contains '" + name + "' more than once");
+		}
+	}
+}
+
+AssetPack::Entry const &AssetPack::lookup(std::string const &name) const {
+	auto f = entries.find(name);
+	if (f == entries.end()) {
+		throw std::runtime_error("Asset pack '" + file.filename + "' doesn't contain '" + name + "'");
+	}
+	//(checked at lookup rather than when opening, so opening a pack doesn't touch every page of it)
+	if (crc32(f->second.data, f->second.size) != f->second.checksum) {
+		throw std::runtime_error("Checksum mismatch for '" + name + "' in asset pack '" + file.filename + "'");
+	}
+	return f->second;
+}
+
+ChunkReader AssetPack::reader(std::string const &name) const {
+	Entry const &entry = lookup(name);
+	return ChunkReader(entry.data, entry.size, file.filename + ":" + name);
+}
+
+uint32_t crc32(uint8_t const *data, size_t size) {
+	//byte-at-a-time table for the reflected IEEE polynomial:
+	static std::array< uint32_t, 256 > const table = [](){
+		std::array< uint32_t, 256 > ret;
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (uint32_t bit = 0; bit < 8; ++bit) {
+				c = (c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1);
+			}
+			ret[i] = c;
+		}
+		return ret;
+	}();
+
+	uint32_t crc = 0xffffffffu;
+	for (size_t i = 0; i < size; ++i) {
+		crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc ^ 0xffffffffu;
+}
+
+//last modification time of a file, in seconds (or -1 if it doesn't exist):
+static int64_t modified_time(std::string const &filename) {
+	#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(filename.c_str(), &info) != 0) return -1;
+	#else
+	struct stat info;
+	if (stat(filename.c_str(), &info) != 0) return -1;
+	#endif
+	return int64_t(info.st_mtime);
+}
+
+AssetPack const *game_assets() {
+	//(function-local static, so opening is thread-safe and happens at most once)
+	static std::unique_ptr< AssetPack > pack = []() -> std::unique_ptr< AssetPack > {
+		std::string filename = data_path("assets.pack");
+		int64_t packed_time = modified_time(filename);
+		if (packed_time < 0) return nullptr;
+		auto ret = std::make_unique< AssetPack >(filename);
+		//a loose file changed after packing (e.g., a re-exported scene) means the pack is stale:
+		for (auto const &entry : ret->entries) {
+			std::string loose = data_path(entry.first);
+			if (modified_time(loose) > packed_time) {
+				std::cout << "WARNING: '" << loose << "' is newer than '" << filename << "'; loading loose files instead (re-run 'node Maekfile.js :pack' to update the pack)." << std::endl;
+				return nullptr;
+			}
+		}
+		return ret;
+	}();
+	return pack.get();
+}
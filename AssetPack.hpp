@@ -0,0 +1,62 @@
+#pragma once
+
+/*
+ * An AssetPack is many asset files (e.g., the contents of dist/) packed into one file,
+ * so loading opens and maps one file and then finds each asset by name without reading the others.
+ *
+ * Packs are built by the pack-assets tool, and use the same chunk layout as read_write_chunk.hpp:
+ *  |pak0|sz| TocEntry * n   <-- table of contents, one entry per packed file
+ *  |str0|sz| names          <-- file names, referenced by the table of contents
+ *  |pad0|sz| 00 ...         <-- zeros, so that the dat0 chunk's data starts at a multiple of Alignment
+ *  |dat0|sz| files          <-- packed files, each starting at a multiple of Alignment
+ *
+ * Since file data stays aligned, chunks within packed files can be used in place (see ChunkReader),
+ * just as when the files are mapped on their own.
+ * Each packed file has a CRC-32 checksum, which is checked when the file is looked up.
+ */
+
+#include "MappedFile.hpp"
+#include "read_write_chunk.hpp"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+struct AssetPack {
+	//open and map a pack (throws std::runtime_error if it isn't a valid pack):
+	explicit AssetPack(std::string const &filename);
+
+	struct TocEntry {
+		uint32_t name_begin, name_end; //in str0
+		uint32_t offset, size; //in dat0
+		uint32_t checksum; //crc32 of the file's bytes
+	};
+	static_assert(sizeof(TocEntry) == 20, "TocEntry is packed.");
+	inline static constexpr uint32_t Alignment = 64;
+
+	//a packed file's bytes (pointing into the mapped pack):
+	struct Entry {
+		uint8_t const *data = nullptr;
+		size_t size = 0;
+		uint32_t checksum = 0;
+	};
+
+	//packed file with a given name (throws std::runtime_error if it isn't in the pack or fails its checksum):
+	// (safe to call from several threads at once)
+	Entry const &lookup(std::string const &name) const;
+	//chunk reader over a packed file (lookup()s it, so throws the same way):
+	ChunkReader reader(std::string const &name) const;
+	//is a file with that name in the pack?
+	bool contains(std::string const &name) const { return entries.count(name) != 0; }
+
+	MappedFile file;
+	std::unordered_map< std::string, Entry > entries;
+};
+
+//CRC-32 (the IEEE polynomial, as used by zip and png) of some bytes:
+uint32_t crc32(uint8_t const *data, size_t size);
+
+//the pack the game's assets have been packed into -- data_path("assets.pack") -- or nullptr if there isn't one:
+// (opened on first call; assets are loose files in dist/ when there's no pack)
+// (also nullptr if any packed file's loose copy in dist/ is newer than the pack, so a stale pack is never used)
+AssetPack const *game_assets();
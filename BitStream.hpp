@@ -0,0 +1,146 @@
+#pragma once
+
+/*
+ * BitWriter / BitReader pack values into (and out of) a byte buffer using
+ * only as many bits as each value needs. Used for network message bodies.
+ *
+ * Bits are stored least-significant-first; the final byte is zero-padded.
+ *
+ *   std::vector< uint8_t > data;
+ *   BitWriter writer(&data);
+ *   writer.write_ranged(state, -3, 8); //4 bits
+ *   writer.write_quantized(x, -32.0f, 32.0f, 16); //16 bits
+ *   writer.flush();
+ *
+ *   BitReader reader(data.data(), data.size());
+ *   int32_t state = reader.read_ranged(-3, 8);
+ *   float x = reader.read_quantized(-32.0f, 32.0f, 16);
+ *   reader.finish(); //throws if there is trailing data
+ *
+ * Readers throw std::runtime_error on malformed data (overruns, out-of-range values).
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+//number of bits needed to store values in [0, range]:
+constexpr uint32_t bits_for_range(uint32_t range) {
+	uint32_t bits = 0;
+	while (bits < 32 && (range >> bits) != 0) ++bits;
+	return bits;
+}
+
+struct BitWriter {
+	BitWriter(std::vector< uint8_t > *out_) : out(*out_) { assert(out_); }
+	~BitWriter() { assert(pending_bits == 0 && "BitWriter should be flush()'d before it is destroyed"); }
+
+	//write the low 'count' bits of 'value':
+	void write_bits(uint32_t value, uint32_t count) {
+		assert(count <= 32);
+		assert(count == 32 || (value >> count) == 0);
+		pending |= uint64_t(value) << pending_bits;
+		pending_bits += count;
+		while (pending_bits >= 8) {
+			out.push_back(uint8_t(pending));
+			pending >>= 8;
+			pending_bits -= 8;
+		}
+	}
+
+	void write_bool(bool value) {
+		write_bits(value ? 1 : 0, 1);
+	}
+
+	//write an integer in [min,max] using just enough bits for the range:
+	void write_ranged(int32_t value, int32_t min, int32_t max) {
+		assert(min <= value && value <= max);
+		write_bits(uint32_t(int64_t(value) - min), bits_for_range(uint32_t(int64_t(max) - min)));
+	}
+
+	//write a float (clamped to [min,max]) quantized to 'bits' bits:
+	// (the range is split into 2^bits equal steps, so values on a power-of-two grid relative to min are exact;
+	//  'max' itself rounds down to the last step)
+	void write_quantized(float value, float min, float max, uint32_t bits) {
+		assert(bits > 0 && bits <= 24 && min < max);
+		uint32_t steps = 1u << bits;
+		float amt = (std::min(std::max(value, min), max) - min) / (max - min);
+		write_bits(std::min(steps - 1, uint32_t(std::lround(amt * float(steps)))), bits);
+	}
+
+	void write_quantized(glm::vec3 const &value, glm::vec3 const &min, glm::vec3 const &max, uint32_t bits) {
+		write_quantized(value.x, min.x, max.x, bits);
+		write_quantized(value.y, min.y, max.y, bits);
+		write_quantized(value.z, min.z, max.z, bits);
+	}
+
+	//pad with zeros to a whole byte:
+	void flush() {
+		if (pending_bits > 0) write_bits(0, 8 - pending_bits);
+	}
+
+	std::vector< uint8_t > &out;
+	uint64_t pending = 0; //bits not yet written to out
+	uint32_t pending_bits = 0;
+};
+
+struct BitReader {
+	BitReader(uint8_t const *data_, size_t size_) : data(data_), size(size_) { }
+
+	uint32_t read_bits(uint32_t count) {
+		assert(count <= 32);
+		while (pending_bits < count) {
+			if (at == size) throw std::runtime_error("Ran out of bits reading message.");
+			pending |= uint64_t(data[at]) << pending_bits;
+			++at;
+			pending_bits += 8;
+		}
+		uint32_t value = uint32_t(pending & ((uint64_t(1) << count) - 1));
+		pending >>= count;
+		pending_bits -= count;
+		return value;
+	}
+
+	bool read_bool() {
+		return read_bits(1) != 0;
+	}
+
+	int32_t read_ranged(int32_t min, int32_t max) {
+		assert(min <= max);
+		uint32_t range = uint32_t(int64_t(max) - min);
+		uint32_t value = read_bits(bits_for_range(range));
+		if (value > range) throw std::runtime_error("Out-of-range value in message.");
+		return int32_t(int64_t(min) + value);
+	}
+
+	float read_quantized(float min, float max, uint32_t bits) {
+		assert(bits > 0 && bits <= 24 && min < max);
+		uint32_t steps = 1u << bits;
+		return min + (max - min) * (float(read_bits(bits)) / float(steps));
+	}
+
+	glm::vec3 read_quantized(glm::vec3 const &min, glm::vec3 const &max, uint32_t bits) {
+		glm::vec3 ret;
+		ret.x = read_quantized(min.x, max.x, bits);
+		ret.y = read_quantized(min.y, max.y, bits);
+		ret.z = read_quantized(min.z, max.z, bits);
+		return ret;
+	}
+
+	//check that the data was consumed exactly (only zero padding left):
+	void finish() {
+		if (pending != 0 || at != size) throw std::runtime_error("Trailing data in message.");
+		pending_bits = 0;
+	}
+
+	uint8_t const *data;
+	size_t size;
+	size_t at = 0; //next byte to load
+	uint64_t pending = 0; //loaded bits not yet read
+	uint32_t pending_bits = 0;
+};
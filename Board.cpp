@@ -0,0 +1,128 @@
+#include "Board.hpp"
+#include "count_neighbours.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+//mixes bits so nearby chunk coordinates get unrelated seeds (splitmix64 finalizer):
+static uint64_t mix(uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+//which chunk a (non-negative) cell is in, and where in that chunk:
+static glm::ivec2 chunk_of(glm::ivec2 cell) {
+	return glm::ivec2(cell.x >> Board::ChunkBits, cell.y >> Board::ChunkBits);
+}
+static uint32_t index_in_chunk(glm::ivec2 cell) {
+	return uint32_t(cell.y & (Board::ChunkSize - 1)) * Board::ChunkSize + uint32_t(cell.x & (Board::ChunkSize - 1));
+}
+
+Board::Board(Config const &config_) : config(config_) {
+	if (config.size == 0) throw std::runtime_error("Board must have at least one cell.");
+	if (config.size > (uint32_t(1) << 30)) throw std::runtime_error("Board size " + std::to_string(config.size) + " is too large.");
+	if (!(config.cell_size > 0.0f)) throw std::runtime_error("Board cell size must be positive.");
+	if (!(config.mine_density >= 0.0f && config.mine_density <= 1.0f)) throw std::runtime_error("Board mine density must be between 0 and 1.");
+}
+
+glm::ivec2 Board::cell_at(glm::vec2 position) const {
+	glm::vec2 offset = (position - config.origin) / config.cell_size;
+	glm::ivec2 cell = glm::ivec2(glm::floor(offset));
+	for (uint32_t axis = 0; axis < 2; ++axis) {
+		if (offset[axis] == float(config.size)) cell[axis] = int32_t(config.size) - 1;
+	}
+	return cell;
+}
+
+int8_t Board::cell(glm::ivec2 at) {
+	assert(contains(at));
+	Chunk &containing = chunk(chunk_of(at));
+	if (!containing.counted) count_chunk(chunk_of(at), containing);
+	return containing.cells[index_in_chunk(at)];
+}
+
+bool Board::is_mine(glm::ivec2 at) {
+	if (!contains(at)) return false;
+	return chunk(chunk_of(at)).cells[index_in_chunk(at)] == Mine;
+}
+
+Board::Chunk &Board::chunk(glm::ivec2 chunk_coords) {
+	uint64_t key = (uint64_t(uint32_t(chunk_coords.x)) << 32) | uint64_t(uint32_t(chunk_coords.y));
+	std::unique_ptr< Chunk > &slot = chunks[key];
+	if (slot) return *slot;
+
+	slot = std::make_unique< Chunk >();
+	Chunk &chunk = *slot;
+	chunk.cells.fill(0);
+
+	//cells of this chunk that may get mines:
+	glm::ivec2 corner = chunk_coords * int32_t(ChunkSize);
+	std::array< uint16_t, ChunkSize * ChunkSize > candidates;
+	uint32_t candidate_count = 0;
+	for (uint32_t y = 0; y < ChunkSize; ++y) {
+		for (uint32_t x = 0; x < ChunkSize; ++x) {
+			glm::ivec2 at = corner + glm::ivec2(x, y);
+			if (!contains(at)) continue;
+			if (std::find(safe_cells.begin(), safe_cells.end(), at) != safe_cells.end()) continue;
+			candidates[candidate_count++] = uint16_t(y * ChunkSize + x);
+		}
+	}
+
+	//place this chunk's share of mines, using a generator that only depends on the board's seed and the chunk's position:
+	uint64_t chunk_seed = mix(config.seed ^ mix(key));
+	std::seed_seq seq{ uint32_t(chunk_seed), uint32_t(chunk_seed >> 32) };
+	std::mt19937 mt(seq);
+	uint32_t mine_count = std::min(candidate_count, uint32_t(std::lround(config.mine_density * float(candidate_count))));
+	for (uint32_t i = 0; i < mine_count; ++i) {
+		//(partial Fisher-Yates shuffle: picks mine_count distinct candidates)
+		uint32_t j = i + uint32_t(mt() % (candidate_count - i));
+		std::swap(candidates[i], candidates[j]);
+		chunk.cells[candidates[i]] = Mine;
+	}
+
+	return chunk;
+}
+
+void Board::count_chunk(glm::ivec2 chunk_coords, Chunk &counting) {
+	assert(!counting.counted);
+
+	//this chunk and its neighbours (or nullptr for chunks entirely off the board):
+	// (chunks are owned by pointer, so these survive other chunks being created)
+	int32_t last_chunk = int32_t((config.size - 1) >> ChunkBits);
+	Chunk const *around[3][3];
+	for (int32_t dy = -1; dy <= 1; ++dy) {
+		for (int32_t dx = -1; dx <= 1; ++dx) {
+			glm::ivec2 c = chunk_coords + glm::ivec2(dx, dy);
+			bool on_board = c.x >= 0 && c.y >= 0 && c.x <= last_chunk && c.y <= last_chunk;
+			around[dy+1][dx+1] = (on_board ? &chunk(c) : nullptr);
+		}
+	}
+
+	//mines of this chunk, with a one-cell border from its neighbours:
+	constexpr uint32_t Padded = ChunkSize + 2;
+	std::array< uint8_t, Padded * Padded > mines;
+	for (uint32_t py = 0; py < Padded; ++py) {
+		//(cell offset within chunk, and which chunk row that falls in)
+		int32_t y = int32_t(py) - 1;
+		uint32_t ay = (y < 0 ? 0 : (y < int32_t(ChunkSize) ? 1 : 2));
+		uint32_t cy = uint32_t(y + int32_t(ChunkSize)) & (ChunkSize - 1);
+		for (uint32_t px = 0; px < Padded; ++px) {
+			int32_t x = int32_t(px) - 1;
+			uint32_t ax = (x < 0 ? 0 : (x < int32_t(ChunkSize) ? 1 : 2));
+			uint32_t cx = uint32_t(x + int32_t(ChunkSize)) & (ChunkSize - 1);
+			Chunk const *from = around[ay][ax];
+			mines[py * Padded + px] = (from && from->cells[cy * ChunkSize + cx] == Mine ? 1 : 0);
+		}
+	}
+
+	count_neighbours(mines.data(), ChunkSize, ChunkSize, counting.cells.data(), ChunkSize);
+	counting.counted = true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+/*
+ * Board is the minesweeper grid players walk on.
+ *
+ * Boards can be very large, so cells are stored in square chunks that are only
+ * created when something looks at them:
+ *  - a chunk's mines are placed when the chunk is first touched, by a random generator
+ *    seeded from the board's seed and the chunk's coordinates (so the same board
+ *    always comes out the same, no matter what order its chunks are visited in);
+ *  - neighbour counts are computed (for a whole chunk at once, see count_neighbours.hpp)
+ *    the first time one of the chunk's cells is asked for, then cached.
+ *
+ * Memory use grows with the area that has been explored (plus a ring of chunks around it
+ * whose mines were needed for counting), not with the board's size.
+ */
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+struct Board {
+	struct Config {
+		uint32_t size = 10; //board is size x size cells
+		float cell_size = 4.0f; //world units per cell
+		glm::vec2 origin = glm::vec2(-20.0f, -20.0f); //world position of the corner of cell (0,0)
+		float mine_density = 0.1f; //fraction of (non-safe) cells with mines
+		uint64_t seed = 0x15466666; //mine layout (and, in Game, spawning) depends only on this; the server picks one per room
+	};
+	explicit Board(Config const &config);
+
+	Config config;
+
+	//cells (x,y) that never get mines (e.g., where players start):
+	// (must be set before any cells are looked at)
+	std::vector< glm::ivec2 > safe_cells;
+
+	//cell values:
+	inline static constexpr int8_t Mine = -1; //otherwise, number of neighbouring mines (0-8)
+
+	//is cell (x,y) on the board?
+	bool contains(glm::ivec2 cell) const {
+		return cell.x >= 0 && cell.y >= 0 && uint32_t(cell.x) < config.size && uint32_t(cell.y) < config.size;
+	}
+	//cell containing a world position (which may be off the board):
+	// (the board's far edges count as part of its last column and row)
+	glm::ivec2 cell_at(glm::vec2 position) const;
+	//value of a cell on the board (Mine or neighbour count):
+	int8_t cell(glm::ivec2 cell);
+	//does a cell have a mine? (cells off the board never do)
+	bool is_mine(glm::ivec2 cell);
+
+	//storage:
+	inline static constexpr uint32_t ChunkBits = 5;
+	inline static constexpr uint32_t ChunkSize = 1 << ChunkBits; //chunks are ChunkSize x ChunkSize cells
+	struct Chunk {
+		std::array< int8_t, ChunkSize * ChunkSize > cells; //Mine or neighbour count (0 until counted); row-major
+		bool counted = false;
+	};
+	std::unordered_map< uint64_t, std::unique_ptr< Chunk > > chunks; //by chunk coordinates (see chunk())
+	//chunk with the given chunk coordinates, with its mines placed:
+	Chunk &chunk(glm::ivec2 chunk_coords);
+	//fill in a chunk's neighbour counts:
+	void count_chunk(glm::ivec2 chunk_coords, Chunk &chunk);
+};
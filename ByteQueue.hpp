@@ -0,0 +1,87 @@
+#pragma once
+
+/*
+ * ByteQueue is a growable FIFO of bytes, used for Connection send/recv buffers.
+ *
+ * Bytes are appended at the back and consumed from the front.
+ * Consuming just advances a read offset (no memmove), and the stored bytes
+ * are always contiguous so message parsers can read them in place:
+ *
+ *   if (queue.size() >= 4 && queue[0] == ...) {
+ *       std::memcpy(&value, queue.data() + 1, 3);
+ *       queue.consume(4);
+ *   }
+ *
+ * Storage is compacted (live bytes moved to the start) only when an append
+ * would otherwise need to grow and the consumed prefix is at least as big as
+ * the live data, so each byte is moved at most a constant number of times.
+ */
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+
+struct ByteQueue {
+	//number of bytes waiting to be consumed:
+	size_t size() const { return tail - head; }
+	bool empty() const { return tail == head; }
+
+	//contiguous view of the waiting bytes:
+	uint8_t *data() { return storage.data() + head; }
+	uint8_t const *data() const { return storage.data() + head; }
+	uint8_t *begin() { return data(); }
+	uint8_t *end() { return data() + size(); }
+	uint8_t const *begin() const { return data(); }
+	uint8_t const *end() const { return data() + size(); }
+	uint8_t &operator[](size_t i) { assert(i < size()); return storage[head + i]; }
+	uint8_t const &operator[](size_t i) const { assert(i < size()); return storage[head + i]; }
+
+	//add bytes to the back of the queue:
+	void append(void const *bytes, size_t count) {
+		if (count == 0) return;
+		reserve_back(count);
+		std::memcpy(storage.data() + tail, bytes, count);
+		tail += count;
+	}
+
+	//remove bytes from the front of the queue:
+	void consume(size_t count) {
+		assert(count <= size());
+		head += count;
+		if (head == tail) head = tail = 0; //empty, so can start over at the beginning for free
+	}
+
+	void clear() { head = tail = 0; }
+
+	//remove all waiting bytes, returning them as a vector:
+	// (moves the storage rather than copying when nothing has been consumed)
+	std::vector< uint8_t > release() {
+		if (head != 0) std::memmove(storage.data(), storage.data() + head, size());
+		storage.resize(size());
+		head = tail = 0;
+		return std::move(storage);
+	}
+
+	//internals:
+	//make room for at least 'count' more bytes after tail:
+	void reserve_back(size_t count) {
+		if (storage.size() - tail >= count) return;
+		size_t live = size();
+		if (head >= live && storage.size() - live >= count) {
+			//consumed prefix is large: slide live data down instead of growing
+			std::memmove(storage.data(), storage.data() + head, live);
+		} else {
+			std::vector< uint8_t > grown(std::max(storage.size() * 2, live + count));
+			if (live) std::memcpy(grown.data(), storage.data() + head, live);
+			storage.swap(grown);
+		}
+		head = 0;
+		tail = live;
+	}
+
+	std::vector< uint8_t > storage;
+	size_t head = 0; //index of first waiting byte in storage
+	size_t tail = 0; //index one past the last waiting byte in storage
+};
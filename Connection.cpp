@@ -24,6 +24,13 @@ typedef int ssize_t;
 #include <netinet/ip.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
 
 #define closesocket close
 
@@ -38,6 +45,8 @@ typedef int ssize_t;
 #include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <random>
+#include <limits>
 
 //NOTE: much of the sockets code herein is based on http-tweak's single-header http server
 // see: https://github.com/ixchow/http-tweak
@@ -47,19 +56,563 @@ typedef int ssize_t;
 
 void Connection::close() {
 	if (socket != InvalidSocket) {
+		#ifdef __linux__
+		if (epoll_fd != -1) {
+			//stop watching the socket for events:
+			// (closing would also do this, but only once every duplicate of the descriptor is closed)
+			epoll_ctl(epoll_fd, EPOLL_CTL_DEL, socket, nullptr);
+			if (owns_udp_socket && udp_socket != InvalidSocket) epoll_ctl(epoll_fd, EPOLL_CTL_DEL, udp_socket, nullptr);
+			epoll_fd = -1;
+		}
+		#endif
 		::closesocket(socket);
 		socket = InvalidSocket;
 	}
+	if (owns_udp_socket && udp_socket != InvalidSocket) {
+		::closesocket(udp_socket);
+		owns_udp_socket = false;
+	}
+	udp_socket = InvalidSocket;
+	unreliable_send_queue.clear();
+}
+
+void Connection::send_block(Block const &block) {
+	assert(block);
+	if (block->empty()) return;
+	queue_send_buffer(); //keep anything appended earlier ahead of the block
+	send_queue.emplace_back();
+	send_queue.back().block = block;
+}
+
+//seconds on a steady clock (used to time datagrams held by UnreliableShim):
+static double now_seconds() {
+	return std::chrono::duration< double >(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Connection::send_unreliable(void const *data, size_t size, Block const &body) {
+	if (!unreliable_ready() || datagram_header_size() + size + (body ? body->size() : 0) > MaxDatagramSize) {
+		send_raw(data, size);
+		if (body) send_block(body);
+		return;
+	}
+	queue_datagram(data, size, body);
+}
+
+void Connection::queue_datagram(void const *data, size_t size, Block const &body) {
+	//every datagram gets a new sequence number (even ones the shim drops, so they look lost in transit):
+	++unreliable_send_seq;
+
+	double release = 0.0;
+	if (shim && shim->active()) {
+		static thread_local std::mt19937 mt(0x15466666);
+		std::uniform_real_distribution< float > unit(0.0f, 1.0f);
+		if (unit(mt) < shim->loss) return;
+		release = now_seconds() + shim->latency + shim->jitter * unit(mt);
+	}
+
+	unreliable_send_queue.emplace_back();
+	Datagram &datagram = unreliable_send_queue.back();
+	size_t header = datagram_header_size();
+	datagram.head.resize(header + size);
+	if (header > sizeof(uint32_t)) std::memcpy(datagram.head.data(), &udp_token, sizeof(uint64_t));
+	std::memcpy(datagram.head.data() + header - sizeof(uint32_t), &unreliable_send_seq, sizeof(uint32_t));
+	if (size) std::memcpy(datagram.head.data() + header, data, size);
+	if (body && !body->empty()) datagram.body = body;
+	datagram.release = release;
+}
+
+bool UnreliableShim::parse_argument(int argc, char **argv, int *at) {
+	assert(at && *at < argc);
+	std::string arg = argv[*at];
+	float *value = nullptr;
+	if (arg == "--udp-loss") value = &loss;
+	else if (arg == "--udp-latency") value = &latency;
+	else if (arg == "--udp-jitter") value = &jitter;
+	else return false;
+
+	if (*at + 1 >= argc) throw std::runtime_error("Expecting a value after '" + arg + "'.");
+	try {
+		*value = std::stof(argv[*at + 1]);
+	} catch (std::exception &) {
+		throw std::runtime_error("Expecting a number after '" + arg + "', got '" + std::string(argv[*at + 1]) + "'.");
+	}
+	if (!(*value >= 0.0f) || (value == &loss && *value > 1.0f)) {
+		throw std::runtime_error("Value " + std::string(argv[*at + 1]) + " for '" + arg + "' is out of range.");
+	}
+	*at += 2;
+	return true;
+}
+
+void Connection::queue_send_buffer() {
+	if (send_buffer.empty()) return;
+	send_queue.emplace_back();
+	send_queue.back().block = std::make_shared< std::vector< uint8_t > const >(send_buffer.release());
+}
+
+//---------------------------------
+//Read/write helpers used by both polling backends:
+
+//read available data from a connection into its recv_buffer:
+// if 'drain' is set, keeps reading until the socket reports no more data (required for edge-triggered polling)
+static void recv_connection(char const *where, Connection &c, std::function< void(Connection *, Connection::Event event) > const &on_event, bool drain) {
+	const uint32_t BufferSize = 20000;
+	static thread_local char *buffer = new char[BufferSize];
+
+	while (c.socket != InvalidSocket) { //read until more data left to read
+		ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~ but no data
+			break;
+		} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
+			//~problem~ so remove connection
+			if (ret == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+			} else if (ret < 0) {
+				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+			} else {
+				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			break;
+		} else { //ret > 0
+			c.recv_buffer.append(buffer, size_t(ret));
+			c.bytes_received += uint64_t(ret);
+			if (c.udp_token_pending) {
+				//(client) the stream starts with the datagram token, which isn't passed on:
+				if (c.recv_buffer.size() < sizeof(uint64_t)) continue;
+				std::memcpy(&c.udp_token, c.recv_buffer.data(), sizeof(uint64_t));
+				c.recv_buffer.consume(sizeof(uint64_t));
+				c.udp_token_pending = false;
+			}
+			if (on_event && !c.recv_buffer.empty()) on_event(&c, Connection::OnRecv);
+			if (!drain && ret < (ssize_t)BufferSize) break; //ran out of data before buffer: no more data left to read
+		}
+	}
+}
+
+//send data queued on a connection (gathering up to a few dozen queued segments per call):
+// if 'drain' is set, keeps sending until nothing is queued or the socket stops accepting data
+// returns 'false' if the socket would block
+static bool send_connection(char const *where, Connection &c, std::function< void(Connection *, Connection::Event event) > const &on_event, bool drain) {
+	c.queue_send_buffer();
+
+	constexpr size_t MaxSegments = 64;
+	while (c.socket != InvalidSocket && !c.send_queue.empty()) {
+		size_t count = 0;
+		size_t total = 0;
+		#ifdef _WIN32
+		WSABUF bufs[MaxSegments];
+		for (auto const &segment : c.send_queue) {
+			if (count == MaxSegments) break;
+			bufs[count].buf = const_cast< CHAR * >(reinterpret_cast< char const * >(segment.block->data() + segment.offset));
+			bufs[count].len = ULONG(segment.block->size() - segment.offset);
+			total += bufs[count].len;
+			++count;
+		}
+		DWORD sent = 0;
+		ssize_t ret = (WSASend(c.socket, bufs, DWORD(count), &sent, 0, NULL, NULL) == 0 ? ssize_t(sent) : -1);
+		if (ret < 0 && WSAGetLastError() == WSAEWOULDBLOCK) errno = EWOULDBLOCK;
+		#else
+		struct iovec iov[MaxSegments];
+		for (auto const &segment : c.send_queue) {
+			if (count == MaxSegments) break;
+			iov[count].iov_base = const_cast< uint8_t * >(segment.block->data() + segment.offset);
+			iov[count].iov_len = segment.block->size() - segment.offset;
+			total += iov[count].iov_len;
+			++count;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t ret = sendmsg(c.socket, &msg, MSG_DONTWAIT);
+		#endif
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~, but don't keep trying
+			return false;
+		} else if (ret <= 0 || ret > (ssize_t)total) {
+			if (ret < 0) {
+				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+			} else { assert(ret == 0 || ret > (ssize_t)total);
+				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << total << "], disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+		} else { //ret seems reasonable
+			c.bytes_sent += uint64_t(ret);
+			//drop sent segments from the queue:
+			size_t remain = size_t(ret);
+			while (remain > 0) {
+				Connection::Segment &front = c.send_queue.front();
+				size_t left = front.block->size() - front.offset;
+				if (remain < left) {
+					front.offset += remain;
+					break;
+				}
+				remain -= left;
+				c.send_queue.pop_front();
+			}
+		}
+		if (!drain) break;
+	}
+	return true;
+}
+
+//Datagram (unreliable channel) helpers used by both polling backends:
+
+//socket shared by a server's connections (or owned by a client's connection) for datagrams:
+struct DatagramContext {
+	Socket socket = InvalidSocket;
+	std::unordered_map< uint64_t, Connection * > *peers = nullptr; //(server only) datagram token -> connection
+	UnreliableShim const *shim = nullptr;
+};
+
+//raw bytes of a socket address with everything but family, address, and port zeroed,
+// so the same peer always produces the same string (returns "" for non-IP addresses):
+static std::string address_key(struct sockaddr const *addr) {
+	if (addr->sa_family == AF_INET) {
+		struct sockaddr_in const *in = reinterpret_cast< struct sockaddr_in const * >(addr);
+		struct sockaddr_in key;
+		memset(&key, 0, sizeof(key));
+		key.sin_family = AF_INET;
+		key.sin_port = in->sin_port;
+		key.sin_addr = in->sin_addr;
+		return std::string(reinterpret_cast< char const * >(&key), sizeof(key));
+	} else if (addr->sa_family == AF_INET6) {
+		struct sockaddr_in6 const *in6 = reinterpret_cast< struct sockaddr_in6 const * >(addr);
+		struct sockaddr_in6 key;
+		memset(&key, 0, sizeof(key));
+		key.sin6_family = AF_INET6;
+		key.sin6_port = in6->sin6_port;
+		key.sin6_addr = in6->sin6_addr;
+		key.sin6_scope_id = in6->sin6_scope_id;
+		return std::string(reinterpret_cast< char const * >(&key), sizeof(key));
+	} else {
+		return "";
+	}
+}
+
+//set up a newly-accepted server connection to use the server's datagram socket:
+// (datagrams are matched to connections by a random token, which is sent to the client as the first bytes on the connection;
+//  a token of 0 tells the client there is no datagram socket)
+static void attach_datagrams(Connection &c, DatagramContext const &datagrams) {
+	c.shim = datagrams.shim;
+	if (datagrams.socket != InvalidSocket && datagrams.peers) {
+		static thread_local std::mt19937_64 mt = [](){
+			std::random_device rd;
+			std::seed_seq seq{rd(), rd(), rd(), rd()};
+			return std::mt19937_64(seq);
+		}();
+		do {
+			c.udp_token = mt();
+		} while (c.udp_token == 0 || datagrams.peers->count(c.udp_token));
+		c.udp_socket = datagrams.socket;
+		(*datagrams.peers)[c.udp_token] = &c;
+	}
+	c.send(c.udp_token);
+}
+
+//read all waiting datagrams, append their payloads to their connections' unreliable_recv_buffers,
+// and report OnRecv (once) for each connection that got data:
+static void recv_datagrams(
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	DatagramContext const &datagrams) {
+
+	const uint32_t BufferSize = 65536; //(largest possible datagram)
+	static thread_local char *buffer = new char[BufferSize];
+	static thread_local std::vector< Connection * > received;
+	received.clear();
+
+	while (true) {
+		struct sockaddr_storage from;
+		socklen_t from_len = sizeof(from);
+		ssize_t ret = recvfrom(datagrams.socket, buffer, BufferSize, MSG_DONTWAIT, reinterpret_cast< struct sockaddr * >(&from), &from_len);
+		//no more data (or an error, e.g., a port-unreachable report -- the channel is unreliable anyway):
+		if (ret < 0) break;
+
+		Connection *c = nullptr;
+		std::string from_key;
+		size_t header = sizeof(uint32_t);
+		if (datagrams.peers) {
+			//expecting [token u64][seq u32][payload]:
+			header += sizeof(uint64_t);
+			if (size_t(ret) < header) continue;
+			uint64_t token;
+			std::memcpy(&token, buffer, sizeof(token));
+			auto f = datagrams.peers->find(token);
+			if (f == datagrams.peers->end()) continue; //not from a known client
+			c = f->second;
+			//once the client's address is known, datagrams from anywhere else are dropped:
+			from_key = address_key(reinterpret_cast< struct sockaddr const * >(&from));
+			if (from_key.empty() || (c->udp_peer_known && from_key != c->udp_peer)) continue;
+		} else {
+			//client sockets are connected, so only receive from the server:
+			// expecting [seq u32][payload]
+			assert(connections.size() == 1);
+			c = &connections.front();
+			if (size_t(ret) < header) continue;
+		}
+		if (c->socket == InvalidSocket) continue;
+
+		c->bytes_received += uint64_t(ret);
+
+		uint32_t seq;
+		std::memcpy(&seq, buffer + header - sizeof(uint32_t), sizeof(seq));
+		//newest wins: drop duplicated, reordered, or stale datagrams:
+		if (c->udp_peer_known && int32_t(seq - c->unreliable_recv_seq) <= 0) continue;
+		c->unreliable_recv_seq = seq;
+		if (!c->udp_peer_known && datagrams.peers) c->udp_peer = from_key;
+		c->udp_peer_known = true;
+
+		if (size_t(ret) > header) {
+			if (c->unreliable_recv_buffer.empty()) received.emplace_back(c);
+			c->unreliable_recv_buffer.append(buffer + header, size_t(ret) - header);
+		}
+	}
+
+	for (Connection *c : received) {
+		if (c->socket != InvalidSocket && on_event) on_event(c, Connection::OnRecv);
+		c->unreliable_recv_buffer.clear();
+	}
+}
+
+//send queued datagrams that are due (all of them, unless UnreliableShim is delaying some):
+// returns the time the next held datagram is due (or infinity if none are held)
+static double send_datagrams(Connection &c) {
+	double next = std::numeric_limits< double >::infinity();
+	if (c.udp_socket == InvalidSocket) {
+		c.unreliable_send_queue.clear();
+		return next;
+	}
+	double now = (c.shim && c.shim->active() ? now_seconds() : 0.0);
+
+	for (auto d = c.unreliable_send_queue.begin(); d != c.unreliable_send_queue.end(); /*later*/) {
+		if (d->release > now) {
+			next = std::min(next, d->release);
+			++d;
+			continue;
+		}
+		//(server sockets are shared, so address each datagram; client sockets are connected to the server)
+		#ifdef _WIN32
+		WSABUF bufs[2];
+		bufs[0].buf = reinterpret_cast< CHAR * >(d->head.data());
+		bufs[0].len = ULONG(d->head.size());
+		DWORD count = 1;
+		if (d->body) {
+			bufs[1].buf = const_cast< CHAR * >(reinterpret_cast< char const * >(d->body->data()));
+			bufs[1].len = ULONG(d->body->size());
+			count = 2;
+		}
+		DWORD sent = 0;
+		int ret = WSASendTo(c.udp_socket, bufs, count, &sent, 0,
+			c.udp_peer.empty() ? NULL : reinterpret_cast< struct sockaddr const * >(c.udp_peer.data()), int(c.udp_peer.size()),
+			NULL, NULL);
+		bool would_block = (ret != 0 && WSAGetLastError() == WSAEWOULDBLOCK);
+		if (ret == 0) c.bytes_sent += sent;
+		#else
+		struct iovec iov[2];
+		iov[0].iov_base = d->head.data();
+		iov[0].iov_len = d->head.size();
+		size_t count = 1;
+		if (d->body) {
+			iov[1].iov_base = const_cast< uint8_t * >(d->body->data());
+			iov[1].iov_len = d->body->size();
+			count = 2;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		if (!c.udp_peer.empty()) {
+			msg.msg_name = const_cast< char * >(c.udp_peer.data());
+			msg.msg_namelen = socklen_t(c.udp_peer.size());
+		}
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		ssize_t ret = sendmsg(c.udp_socket, &msg, MSG_DONTWAIT);
+		bool would_block = (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+		if (ret > 0) c.bytes_sent += uint64_t(ret);
+		#endif
+		//socket buffer is full; try again next poll:
+		if (would_block) break;
+		//(other errors just lose the datagram, which the channel allows for)
+		d = c.unreliable_send_queue.erase(d);
+	}
+	return next;
+}
+
+//send due datagrams on all connections, returning how long until the next held datagram is due:
+static double flush_datagrams(std::list< Connection > &connections) {
+	double next = std::numeric_limits< double >::infinity();
+	for (auto &c : connections) {
+		if (c.socket == InvalidSocket || c.unreliable_send_queue.empty()) continue;
+		next = std::min(next, send_datagrams(c));
+	}
+	return (next == std::numeric_limits< double >::infinity() ? next : std::max(0.0, next - now_seconds()));
+}
+
+//make a socket non-blocking; returns false on failure:
+static bool set_nonblocking(Socket s) {
+	#ifdef _WIN32
+	unsigned long one = 1;
+	return ioctlsocket(s, FIONBIO, &one) == 0;
+	#else
+	int flags = fcntl(s, F_GETFL, 0);
+	return flags >= 0 && fcntl(s, F_SETFL, flags | O_NONBLOCK) == 0;
+	#endif
+}
+
+//read everything waiting on a server's wake_socket, so it stops reporting readable until the next wake():
+static void drain_wake(Socket wake_socket) {
+	#ifdef __linux__
+	uint64_t count; //(reading an eventfd returns and resets its counter)
+	ssize_t ret = read(wake_socket, &count, sizeof(count));
+	(void)ret;
+	#else
+	char buffer[64];
+	while (recv(wake_socket, buffer, sizeof(buffer), MSG_DONTWAIT) > 0) { }
+	#endif
 }
 
 //---------------------------------
 //Polling helper used by both server and client:
+
+#ifdef __linux__
+//On linux, sockets stay registered with an epoll instance for their whole lifetime,
+// so the cost of a poll is proportional to the number of events rather than the number of connections:
+
+//epoll data pointers for sockets that aren't connections:
+// (the listen socket uses a null pointer)
+static char DatagramMarker;
+static char WakeMarker;
+
+//accept all pending connections on listen_socket and register them with epoll_fd:
+static void accept_connections(
+	char const *where,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	int epoll_fd,
+	Socket listen_socket,
+	DatagramContext const &datagrams) {
+
+	while (true) { //(listen_socket is non-blocking, so accept until there is nobody left waiting)
+		struct sockaddr_storage peer;
+		socklen_t peer_len = sizeof(peer);
+		Socket got = accept(listen_socket, reinterpret_cast< struct sockaddr * >(&peer), &peer_len);
+		if (got == InvalidSocket) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				std::cerr << "[" << where << "] accept() returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+			}
+			break;
+		}
+		connections.emplace_back();
+		Connection &c = connections.back();
+		c.socket = got;
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = &c;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c.socket, &event) != 0) {
+			std::cerr << "[" << where << "] failed to register socket " << c.socket << " with epoll (" << strerror(errno) << "), disconnecting." << std::endl;
+			c.close(); //never reported, so don't send OnClose
+			continue;
+		}
+		c.epoll_fd = epoll_fd;
+		attach_datagrams(c, datagrams);
+
+		std::cerr << "[" << where << "] client connected on " << c.socket << "." << std::endl; //INFO
+		if (on_event) on_event(&c, Connection::OnOpen);
+	}
+}
+
 void poll_connections(
 	char const *where,
 	std::list< Connection > &connections,
 	std::function< void(Connection *, Connection::Event event) > const &on_event,
 	double timeout,
-	Socket listen_socket = InvalidSocket) {
+	int epoll_fd,
+	Socket listen_socket,
+	DatagramContext const &datagrams,
+	Socket wake_socket) {
+
+	assert(epoll_fd != -1);
+
+	//flush anything queued since the last poll on sockets known to be writable:
+	// (edge-triggered sockets only report writability again after they have reported EAGAIN)
+	for (auto &c : connections) {
+		if (c.socket == InvalidSocket || !c.writable || !c.send_pending()) continue;
+		c.writable = send_connection(where, c, on_event, true);
+	}
+	//(datagrams held back by the shim need a wakeup when they are due)
+	timeout = std::min(timeout, flush_datagrams(connections));
+
+	constexpr int MaxEvents = 256;
+	static thread_local struct epoll_event events[MaxEvents];
+
+	int count;
+	{ //wait (until timeout) for sockets' state to change:
+		int timeout_ms = int(std::ceil(std::max(0.0, timeout) * 1000.0));
+		count = epoll_wait(epoll_fd, events, MaxEvents, timeout_ms);
+
+		if (count < 0) {
+			if (errno != EINTR) {
+				std::cerr << "[" << where << "] epoll_wait returned error " << errno << "(" << strerror(errno) << ")." << std::endl;
+			}
+			return;
+		}
+		//NOTE: if more than MaxEvents are ready, the rest stay queued in the kernel for the next poll.
+	}
+
+	for (int i = 0; i < count; ++i) {
+		if (events[i].data.ptr == nullptr) {
+			//add new connections as needed:
+			assert(listen_socket != InvalidSocket);
+			accept_connections(where, connections, on_event, epoll_fd, listen_socket, datagrams);
+			continue;
+		}
+		if (events[i].data.ptr == &DatagramMarker) {
+			assert(datagrams.socket != InvalidSocket);
+			recv_datagrams(connections, on_event, datagrams);
+			continue;
+		}
+		if (events[i].data.ptr == &WakeMarker) {
+			//(nothing to do but return, so the caller can look at whatever it was woken for)
+			assert(wake_socket != InvalidSocket);
+			drain_wake(wake_socket);
+			continue;
+		}
+
+		Connection &c = *reinterpret_cast< Connection * >(events[i].data.ptr);
+		//connection may have been closed by an event handler earlier in this batch:
+		if (c.socket == InvalidSocket) continue;
+
+		//process requests:
+		// (hangups and errors are read as well, so recv() reports them and the connection gets closed)
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			recv_connection(where, c, on_event, true);
+		}
+
+		//process responses:
+		if (events[i].events & EPOLLOUT) {
+			c.writable = send_connection(where, c, on_event, true);
+		}
+	}
+}
+
+#else //select()-based fallback for other platforms:
+
+void poll_connections(
+	char const *where,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket,
+	DatagramContext const &datagrams,
+	Socket wake_socket) {
+
+	//(datagrams held back by the shim need a wakeup when they are due)
+	timeout = std::min(timeout, flush_datagrams(connections));
 
 	fd_set read_fds, write_fds;
 	FD_ZERO(&read_fds);
@@ -73,12 +626,24 @@ void poll_connections(
 		FD_SET(listen_socket, &read_fds);
 	}
 
+	//add datagram socket to fd_set if needed:
+	if (datagrams.socket != InvalidSocket) {
+		max = std::max(max, int(datagrams.socket));
+		FD_SET(datagrams.socket, &read_fds);
+	}
+
+	//add wake socket to fd_set if needed:
+	if (wake_socket != InvalidSocket) {
+		max = std::max(max, int(wake_socket));
+		FD_SET(wake_socket, &read_fds);
+	}
+
 	//add each connection's socket to read (and possibly write) sets:
-	for (auto c : connections) {
+	for (auto const &c : connections) {
 		if (c.socket != InvalidSocket) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
-			if (!c.send_buffer.empty()) {
+			if (c.send_pending()) {
 				FD_SET(c.socket, &write_fds);
 			}
 		}
@@ -101,7 +666,9 @@ void poll_connections(
 
 	//add new connections as needed:
 	if (listen_socket != InvalidSocket && FD_ISSET(listen_socket, &read_fds)) {
-		Socket got = accept(listen_socket, NULL, NULL);
+		struct sockaddr_storage peer;
+		socklen_t peer_len = sizeof(peer);
+		Socket got = accept(listen_socket, reinterpret_cast< struct sockaddr * >(&peer), &peer_len);
 		if (got == InvalidSocket) {
 			//oh well.
 		} else {
@@ -113,74 +680,40 @@ void poll_connections(
 			#endif
 				connections.emplace_back();
 				connections.back().socket = got;
+				attach_datagrams(connections.back(), datagrams);
 				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
 				if (on_event) on_event(&connections.back(), Connection::OnOpen);
 			}
 		}
 	}
 
-	const uint32_t BufferSize = 20000;
-	static thread_local char *buffer = new char[BufferSize];
+	//process datagrams:
+	if (datagrams.socket != InvalidSocket && FD_ISSET(datagrams.socket, &read_fds)) {
+		recv_datagrams(connections, on_event, datagrams);
+	}
+
+	//clear wakeups:
+	if (wake_socket != InvalidSocket && FD_ISSET(wake_socket, &read_fds)) {
+		drain_wake(wake_socket);
+	}
 
 	//process requests:
 	for (auto &c : connections) {
 		//only read from valid sockets marked readable:
 		if (c.socket == InvalidSocket || !FD_ISSET(c.socket, &read_fds)) continue;
-
-		while (true) { //read until more data left to read
-			ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
-			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-				//~no problem~ but no data
-				break;
-			} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
-				//~problem~ so remove connection
-				if (ret == 0) {
-					std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
-				} else if (ret < 0) {
-					std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
-				} else {
-					std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
-				}
-				c.close();
-				if (on_event) on_event(&c, Connection::OnClose);
-				break;
-			} else { //ret > 0
-				c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
-				if (on_event) on_event(&c, Connection::OnRecv);
-				if (ret < BufferSize) break; //ran out of data before buffer: no more data left to read
-			}
-		}
+		recv_connection(where, c, on_event, false);
 	}
 
 	//process responses:
 	for (auto &c : connections) {
 		//don't bother with connections unless they are valid, have something to send, and are marked writable:
-		if (c.socket == InvalidSocket || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
-		
-		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
-		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
-		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-			//~no problem~, but don't keep trying
-			break;
-		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
-			if (ret < 0) {
-				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
-			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
-			}
-			c.close();
-			if (on_event) on_event(&c, Connection::OnClose);
-		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
-		}
+		if (c.socket == InvalidSocket || !c.send_pending() || !FD_ISSET(c.socket, &write_fds)) continue;
+		send_connection(where, c, on_event, false);
 	}
-
-		
 }
 
+#endif
+
 //---------------------------------
 
 
@@ -255,6 +788,18 @@ Server::Server(std::string const &port) {
 			std::cout << "success!" << std::endl;
 
 			listen_socket = s;
+
+			{ //bind a datagram socket to the same address, for the unreliable channel:
+				Socket u = socket(info->ai_family, SOCK_DGRAM, IPPROTO_UDP);
+				if (u != InvalidSocket && (bind(u, info->ai_addr, int(info->ai_addrlen)) < 0 || !set_nonblocking(u))) {
+					closesocket(u);
+					u = InvalidSocket;
+				}
+				if (u == InvalidSocket) {
+					std::cout << "[note: couldn't set up datagram socket (" << strerror(errno) << "); sending everything over TCP] " << std::endl;
+				}
+				udp_socket = u;
+			}
 			break;
 		}
 
@@ -266,22 +811,120 @@ Server::Server(std::string const &port) {
 	}
 
 	{ //listen on socket
-		int ret = ::listen(listen_socket, 5);
+		int ret = ::listen(listen_socket, SOMAXCONN); //(large backlog so bursts of clients can connect between polls)
 		if (ret < 0) {
 			closesocket(listen_socket);
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	#ifdef __linux__
+	wake_socket = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wake_socket < 0) {
+		closesocket(listen_socket);
+		throw std::system_error(errno, std::system_category(), "failed to create eventfd");
+	}
+	#else
+	{ //no eventfd here, so wake() sends a byte to a loopback datagram socket that is connected to itself:
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0; //(any free port)
+		socklen_t addr_len = sizeof(addr);
+		Socket s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+		if (s == InvalidSocket
+		 || bind(s, reinterpret_cast< struct sockaddr * >(&addr), sizeof(addr)) != 0
+		 || getsockname(s, reinterpret_cast< struct sockaddr * >(&addr), &addr_len) != 0
+		 || connect(s, reinterpret_cast< struct sockaddr * >(&addr), addr_len) != 0
+		 || !set_nonblocking(s)) {
+			if (s != InvalidSocket) closesocket(s);
+			closesocket(listen_socket);
+			throw std::runtime_error("Failed to set up loopback socket for waking the server.");
+		}
+		wake_socket = s;
+	}
+	#endif
+
+	#ifdef __linux__
+	{ //watch listen socket with epoll:
+		//accept() is called until it runs out of pending connections, so it must not block:
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) != 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to make listen socket non-blocking");
+		}
+
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+
+		//(level-triggered; a null data pointer marks the listen socket)
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.ptr = nullptr;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_socket, &event) != 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to register listen socket with epoll");
+		}
+
+		//(also level-triggered; marked with &DatagramMarker)
+		if (udp_socket != InvalidSocket) {
+			event.events = EPOLLIN;
+			event.data.ptr = &DatagramMarker;
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, udp_socket, &event) != 0) {
+				std::cout << "[note: couldn't watch datagram socket with epoll (" << strerror(errno) << "); sending everything over TCP] " << std::endl;
+				closesocket(udp_socket);
+				udp_socket = InvalidSocket;
+			}
+		}
+
+		//(also level-triggered, marked with &WakeMarker; drained by each poll that sees it)
+		event.events = EPOLLIN;
+		event.data.ptr = &WakeMarker;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_socket, &event) != 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to register eventfd with epoll");
+		}
+	}
+	#endif
+}
+
+void Server::wake() {
+	assert(wake_socket != InvalidSocket);
+	//(if the write fails because wakes are already pending, the poll will return anyway)
+	#ifdef __linux__
+	uint64_t one = 1;
+	ssize_t ret = write(wake_socket, &one, sizeof(one));
+	#else
+	char one = 1;
+	ssize_t ret = send(wake_socket, &one, 1, 0);
+	#endif
+	(void)ret;
 }
 
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
+	DatagramContext datagrams;
+	datagrams.socket = udp_socket;
+	datagrams.peers = &udp_peers;
+	datagrams.shim = &unreliable_shim;
+
+	#ifdef __linux__
+	poll_connections("Server::poll", connections, on_event, timeout, epoll_fd, listen_socket, datagrams, wake_socket);
+	#else
+	poll_connections("Server::poll", connections, on_event, timeout, listen_socket, datagrams, wake_socket);
+	#endif
 
 	//reap closed clients:
 	for (auto connection = connections.begin(); connection != connections.end(); /*later*/) {
 		auto old = connection;
 		++connection;
 		if (old->socket == InvalidSocket) {
+			auto f = udp_peers.find(old->udp_token);
+			if (f != udp_peers.end() && f->second == &*old) udp_peers.erase(f);
 			connections.erase(old);
 		}
 	}
@@ -352,10 +995,82 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 			throw std::runtime_error("Failed to connect to any of the addresses tried for server.");
 		}
 	}
+
+	//the server starts the stream with the token that pairs datagrams with this connection:
+	connection.udp_token_pending = true;
+
+	{ //datagram socket for the unreliable channel:
+		// connected to the server (so only the server's datagrams are received)
+		struct sockaddr_storage remote;
+		socklen_t remote_len = sizeof(remote);
+		Socket u = InvalidSocket;
+		if (getpeername(connection.socket, reinterpret_cast< struct sockaddr * >(&remote), &remote_len) == 0) {
+			u = socket(remote.ss_family, SOCK_DGRAM, IPPROTO_UDP);
+		}
+		if (u != InvalidSocket && (
+			   connect(u, reinterpret_cast< struct sockaddr * >(&remote), remote_len) != 0
+			|| !set_nonblocking(u))) {
+			closesocket(u);
+			u = InvalidSocket;
+		}
+		if (u == InvalidSocket) {
+			std::cout << "[note: couldn't set up datagram socket (" << strerror(errno) << "); sending everything over TCP]" << std::endl;
+		} else {
+			connection.udp_socket = u;
+			connection.owns_udp_socket = true;
+		}
+		connection.shim = &unreliable_shim;
+	}
+
+	#ifdef __linux__
+	{ //watch connection with epoll:
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (epoll_fd < 0) {
+			throw std::system_error(errno, std::system_category(), "failed to create epoll instance");
+		}
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		event.data.ptr = &connection;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection.socket, &event) != 0) {
+			throw std::system_error(errno, std::system_category(), "failed to register connection with epoll");
+		}
+		connection.epoll_fd = epoll_fd;
+
+		//(datagram socket is level-triggered and marked with &DatagramMarker)
+		if (connection.udp_socket != InvalidSocket) {
+			event.events = EPOLLIN;
+			event.data.ptr = &DatagramMarker;
+			if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, connection.udp_socket, &event) != 0) {
+				std::cout << "[note: couldn't watch datagram socket with epoll (" << strerror(errno) << "); sending everything over TCP]" << std::endl;
+				closesocket(connection.udp_socket);
+				connection.udp_socket = InvalidSocket;
+				connection.owns_udp_socket = false;
+			}
+		}
+	}
+	#endif
 }
 
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket);
+	if (connection && connection.udp_socket != InvalidSocket && connection.udp_token != 0 && !connection.udp_peer_known) {
+		auto now = std::chrono::steady_clock::now();
+		if (now >= next_hello) {
+			connection.queue_datagram(nullptr, 0, nullptr);
+			next_hello = now + std::chrono::milliseconds(250);
+		}
+	}
+
+	DatagramContext datagrams;
+	datagrams.socket = connection.udp_socket;
+	datagrams.shim = &unreliable_shim;
+
+	#ifdef __linux__
+	poll_connections("Client::poll", connections, on_event, timeout, epoll_fd, InvalidSocket, datagrams, InvalidSocket);
+	#else
+	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket, datagrams, InvalidSocket);
+	#endif
 }
 
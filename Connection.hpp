@@ -14,7 +14,7 @@ int main(int argc, char **argv) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
 				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
+				std::vector< uint8_t > data(connection->recv_buffer.begin(), connection->recv_buffer.end());
 				connection->recv_buffer.clear();
 				//send to other connections:
 
@@ -60,12 +60,19 @@ int main(int argc, char **argv) {
 #endif
 //--------- ---------------------------------- ---------
 
+#include "ByteQueue.hpp"
+
 #include <vector>
+#include <deque>
 #include <list>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <functional>
+#include <chrono>
 
-//Thin wrapper around a (polling-based) TCP socket connection:
+//Thin wrapper around a (polling-based) TCP socket connection, with an optional unreliable (UDP) side channel:
+// (on linux, polling uses edge-triggered epoll; elsewhere it falls back to select())
 struct Connection {
 	//Helper that will append any type to the send buffer:
 	template< typename T >
@@ -74,9 +81,40 @@ struct Connection {
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.append(data, size);
 	}
 
+	//Immutable block of bytes that can be queued on many connections without being copied:
+	typedef std::shared_ptr< std::vector< uint8_t > const > Block;
+	//Helper that will queue a shared block to be sent after everything already in the send buffer:
+	void send_block(Block const &block);
+
+	//is there any data (in send_buffer or send_queue) waiting to be sent?
+	bool send_pending() const { return !send_buffer.empty() || !send_queue.empty(); }
+
+	//Unreliable channel (UDP, on the same port as the server's TCP socket):
+	// each call sends one datagram, which may be lost or reordered in transit.
+	// The receiving end drops datagrams older than the newest it has seen, so newer data always wins.
+	// Datagram payloads are 'data' followed by 'body' (if given; queued by reference like send_block).
+	// Until the channel is known to work (or if the datagram would be too large), falls back to the reliable channel.
+	// Datagrams are paired with connections by a random token the server sends over TCP, not by address,
+	//  so clients behind NAT work and other hosts can't inject datagrams into a connection.
+	void send_unreliable(void const *data, size_t size, Block const &body = nullptr);
+	//largest datagram (including its header) sent unreliably; stays under common path MTUs:
+	inline static constexpr size_t MaxDatagramSize = 1200;
+	//bytes in front of each datagram's payload: sequence number (client datagrams start with udp_token as well):
+	size_t datagram_header_size() const { return (owns_udp_socket ? sizeof(uint64_t) : 0) + sizeof(uint32_t); }
+
+	//can data be sent over the unreliable channel yet?
+	// (i.e., once a datagram has arrived from the other end)
+	bool unreliable_ready() const { return udp_socket != InvalidSocket && udp_peer_known; }
+
+	//Which channel to send a message over:
+	enum Channel {
+		Reliable,
+		Unreliable
+	};
+
 	//Call 'close' to mark a connection for discard:
 	void close();
 
@@ -84,12 +122,54 @@ struct Connection {
 	explicit operator bool() { return socket != InvalidSocket; }
 
 	//To send data over a connection, append it to send_buffer:
-	std::vector< uint8_t > send_buffer;
+	// (bytes may be patched in place until the next poll, which moves them to send_queue)
+	ByteQueue send_buffer;
 	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< uint8_t > recv_buffer;
+	// (parsers should consume() whole messages from the front once handled)
+	ByteQueue recv_buffer;
+	//Payloads of (non-stale) datagrams received since the last poll are appended to unreliable_recv_buffer:
+	// (it is cleared after the OnRecv event, so parse any messages it contains during that event)
+	ByteQueue unreliable_recv_buffer;
+
+	//bytes that have actually gone out on / come in from the network over both channels (datagram headers included):
+	// (for measuring bandwidth; counted as the sockets accept or deliver them, so they include anything sent without send())
+	uint64_t bytes_sent = 0;
+	uint64_t bytes_received = 0;
 
 	//internals:
+	//data waiting to be sent, in order; written with one gathering send call per poll:
+	struct Segment {
+		Block block;
+		size_t offset = 0; //bytes of block already sent
+	};
+	std::deque< Segment > send_queue;
+	//move the contents of send_buffer onto the end of send_queue:
+	void queue_send_buffer();
+
 	Socket socket = InvalidSocket;
+	int epoll_fd = -1; //(linux) epoll instance the socket is registered with, if any
+	bool writable = true; //(linux) false once send() would block, until epoll reports the socket writable again
+
+	//unreliable channel state:
+	Socket udp_socket = InvalidSocket; //datagram socket (server: shared by all connections; client: owned by the connection)
+	bool owns_udp_socket = false;
+	std::string udp_peer; //(server) address of the client's datagram socket (raw sockaddr bytes; learned from the first datagram carrying udp_token)
+	bool udp_peer_known = false; //has a datagram arrived from the other end?
+	//pairs datagrams with this connection: (server) picked at random on accept and sent as the first bytes over TCP;
+	// (client) read from the front of the TCP stream, then sent at the start of every datagram (0 if the server has no datagram socket)
+	uint64_t udp_token = 0;
+	bool udp_token_pending = false; //(client) still waiting for udp_token to arrive over TCP?
+	uint32_t unreliable_send_seq = 0; //sequence number of last datagram sent
+	uint32_t unreliable_recv_seq = 0; //sequence number of newest datagram received
+	struct Datagram {
+		std::vector< uint8_t > head; //header (see datagram_header_size) + 'data' from send_unreliable
+		Block body;
+		double release = 0.0; //(only used with UnreliableShim) when to actually send
+	};
+	std::deque< Datagram > unreliable_send_queue;
+	//add a datagram to unreliable_send_queue (without checking unreliable_ready()):
+	void queue_datagram(void const *data, size_t size, Block const &body);
+	struct UnreliableShim const *shim = nullptr; //(testing) artificial loss/latency for outgoing datagrams
 
 	enum Event {
 		OnOpen,
@@ -98,6 +178,20 @@ struct Connection {
 	};
 };
 
+//For testing the unreliable channel over loopback:
+// artificially drops and delays outgoing datagrams.
+struct UnreliableShim {
+	float loss = 0.0f; //fraction of datagrams dropped
+	float latency = 0.0f; //seconds each datagram is held before it is sent
+	float jitter = 0.0f; //extra random delay of up to this many seconds (so datagrams may arrive out of order)
+
+	bool active() const { return loss > 0.0f || latency > 0.0f || jitter > 0.0f; }
+
+	//parse a "--udp-loss <fraction>", "--udp-latency <seconds>", or "--udp-jitter <seconds>" argument at argv[*at]:
+	// returns true (and advances *at past it) if argv[*at] was one of these options
+	bool parse_argument(int argc, char **argv, int *at);
+};
+
 struct Server {
 	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
 
@@ -108,8 +202,21 @@ struct Server {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
+	//end a poll() that is waiting (or make the next one return right away); may be called from any thread:
+	// (several wakes before a poll notices them count as one)
+	void wake();
+
 	std::list< Connection > connections;
 	Socket listen_socket = InvalidSocket;
+	Socket udp_socket = InvalidSocket; //bound to the same address as listen_socket (InvalidSocket if that failed)
+	int epoll_fd = -1; //(linux) epoll instance watching listen_socket, udp_socket, wake_socket, and all connections
+	Socket wake_socket = InvalidSocket; //written by wake() and watched by poll(): (linux) an eventfd; (elsewhere) a loopback datagram socket connected to itself
+
+	//(testing) applied to datagrams sent to all connections:
+	UnreliableShim unreliable_shim;
+
+	//internals:
+	std::unordered_map< uint64_t, Connection * > udp_peers; //datagram token -> connection
 };
 
 
@@ -125,4 +232,13 @@ struct Client {
 
 	std::list< Connection > connections; //will only ever contain exactly one connection
 	Connection &connection; //reference to the only connection in the connections list
+	int epoll_fd = -1; //(linux) epoll instance watching the connection
+
+	//(testing) applied to datagrams sent to the server:
+	UnreliableShim unreliable_shim;
+
+	//internals:
+	//once udp_token has arrived, and until the server is heard from over the unreliable channel,
+	// an empty datagram is sent periodically so it can learn the client's datagram address:
+	std::chrono::steady_clock::time_point next_hello;
 };
@@ -1,182 +1,402 @@
 #include "Game.hpp"
 
 #include "Connection.hpp"
+#include "BitStream.hpp"
 
 #include <stdexcept>
 #include <iostream>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
 
 #include <glm/gtx/norm.hpp>
 
-void Player::send_player_message(Connection *connection_) const {
+//facing is sent as a fraction of a turn:
+static uint32_t quantize_yaw(float yaw) {
+	constexpr float Tau = 6.28318530718f;
+	float turns = yaw / Tau;
+	turns -= std::floor(turns);
+	return uint32_t(std::lround(turns * float(1 << Player::YawBits))) & ((1 << Player::YawBits) - 1);
+}
+static float dequantize_yaw(uint32_t bits) {
+	constexpr float Tau = 6.28318530718f;
+	return float(bits) / float(1 << Player::YawBits) * Tau;
+}
+
+Player::Input Player::sample_input(uint32_t seq, float yaw) const {
+	Input input;
+	input.seq = seq;
+	if (controls.left.pressed) input.buttons |= ButtonLeft;
+	if (controls.right.pressed) input.buttons |= ButtonRight;
+	if (controls.up.pressed) input.buttons |= ButtonUp;
+	if (controls.down.pressed) input.buttons |= ButtonDown;
+	if (controls.jump.pressed) input.buttons |= ButtonJump;
+	//(prediction must use exactly the facing the server will decode)
+	input.yaw = dequantize_yaw(quantize_yaw(yaw));
+	return input;
+}
+
+glm::vec3 Player::input_step(Input const &input) {
+	//combine buttons into a move:
+	glm::vec2 move = glm::vec2(0.0f);
+	bool left = (input.buttons & ButtonLeft), right = (input.buttons & ButtonRight);
+	bool down = (input.buttons & ButtonDown), up = (input.buttons & ButtonUp);
+	if (left && !right) move.x =-1.0f;
+	if (!left && right) move.x = 1.0f;
+	if (down && !up) move.y =-1.0f;
+	if (!down && up) move.y = 1.0f;
+	if (move == glm::vec2(0.0f)) return glm::vec3(0.0f);
+
+	//make it so that moving diagonally doesn't go faster:
+	move = glm::normalize(move) * Game::PlayerSpeed * Game::Tick;
+
+	//rotate into the world by facing:
+	float c = std::cos(input.yaw), s = std::sin(input.yaw);
+	return glm::vec3(c * move.x - s * move.y, s * move.x + c * move.y, 0.0f);
+}
+
+uint32_t Player::view_of_time(double time) {
+	return uint32_t(std::llround(time / double(Game::Tick) * double(ViewSteps)));
+}
+
+uint32_t Player::controls_message_size(uint32_t input_count) {
+	//first seq, count, then buttons + yaw + view per input:
+	return (32 + 8 + input_count * (ButtonBits + YawBits + ViewBits) + 7) / 8;
+}
+
+void Player::send_controls_message(Connection *connection_, Connection::Channel channel) const {
 	assert(connection_);
 	auto &connection = *connection_;
 
-	uint32_t size = sizeof(glm::vec3);
-	assert(sizeof(glm::vec3) == 12);
-	connection.send(Message::C2S_PlayerPos);
-	connection.send(uint8_t(size));
-	connection.send(uint8_t(size >> 8));
-	connection.send(uint8_t(size >> 16));
+	if (inputs.empty()) return;
+
+	//newest inputs, which are consecutive:
+	uint32_t count = std::min(uint32_t(inputs.size()), MaxInputsPerMessage);
+	auto first = inputs.end() - count;
 
-	connection.send(position);
+	//message is built in one piece so it can go out as a single datagram:
+	uint32_t size = controls_message_size(count);
+	std::vector< uint8_t > message{
+		uint8_t(Message::C2S_Controls),
+		uint8_t(size),
+		uint8_t(size >> 8),
+		uint8_t(size >> 16)
+	};
+	message.reserve(4 + size);
+	BitWriter writer(&message);
+	writer.write_bits(first->seq, 32);
+	writer.write_bits(count, 8);
+	for (auto input = first; input != inputs.end(); ++input) {
+		assert(input->seq == first->seq + uint32_t(input - first));
+		writer.write_bits(input->buttons, ButtonBits);
+		writer.write_bits(quantize_yaw(input->yaw), YawBits);
+		writer.write_bits(input->view & ((1 << ViewBits) - 1), ViewBits);
+	}
+	writer.flush();
+	assert(message.size() == 4 + size);
+
+	if (channel == Connection::Unreliable) connection.send_unreliable(message.data(), message.size());
+	else connection.send_raw(message.data(), message.size());
 }
 
-bool Player::recv_player_message(Connection *connection_) {
+bool Player::recv_controls_message(Connection *connection_) {
 	assert(connection_);
 	auto &connection = *connection_;
 
-	auto &recv_buffer = connection.recv_buffer;
+	return recv_controls_message(connection.recv_buffer) || recv_controls_message(connection.unreliable_recv_buffer);
+}
 
+bool Player::recv_controls_message(ByteQueue &recv_buffer) {
 	//expecting [type, size_low0, size_mid8, size_high8]:
 	if (recv_buffer.size() < 4) return false;
-	if (recv_buffer[0] != uint8_t(Message::C2S_PlayerPos)) return false;
+	if (recv_buffer[0] != uint8_t(Message::C2S_Controls)) return false;
 	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
 	              | (uint32_t(recv_buffer[2]) << 8)
 	              |  uint32_t(recv_buffer[1]);
-	if (size != 12) throw std::runtime_error("Controls message with size " + std::to_string(size) + " != 5!");
-	
+	if (size < controls_message_size(1) || size > controls_message_size(MaxInputsPerMessage)) {
+		throw std::runtime_error("Controls message with size " + std::to_string(size) + " is out of range!");
+	}
+
 	//expecting complete message:
 	if (recv_buffer.size() < 4 + size) return false;
 
-	std::memcpy(&position, &recv_buffer[4+0], sizeof(glm::vec3));
+	BitReader reader(recv_buffer.data() + 4, size);
+	uint32_t first_seq = reader.read_bits(32);
+	uint32_t count = reader.read_bits(8);
+	if (count == 0 || count > MaxInputsPerMessage || size != controls_message_size(count)) {
+		throw std::runtime_error("Controls message with " + std::to_string(count) + " inputs has size " + std::to_string(size) + "!");
+	}
+	if (first_seq == 0 || first_seq + count < first_seq) throw std::runtime_error("Controls message with bad input sequence numbers.");
+	inputs.resize(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		inputs[i].seq = first_seq + i;
+		inputs[i].buttons = uint8_t(reader.read_bits(ButtonBits));
+		inputs[i].yaw = dequantize_yaw(reader.read_bits(YawBits));
+		inputs[i].view = reader.read_bits(ViewBits);
+	}
+	reader.finish();
 
 	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	recv_buffer.consume(4 + size);
 
 	return true;
 }
 
 
+bool Player::recv_ack_message(Connection *connection_) {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	return recv_ack_message(connection.recv_buffer) || recv_ack_message(connection.unreliable_recv_buffer);
+}
+
+bool Player::recv_ack_message(ByteQueue &recv_buffer) {
+	//expecting [type, size_low0, size_mid8, size_high8]:
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::C2S_Ack)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size != 4) throw std::runtime_error("Ack message with size " + std::to_string(size) + " != 4!");
+
+	//expecting complete message:
+	if (recv_buffer.size() < 4 + size) return false;
+
+	uint32_t seq;
+	std::memcpy(&seq, &recv_buffer[4+0], sizeof(seq));
+	//acks can only move forward:
+	if (seq > acked_snapshot) acked_snapshot = seq;
+
+	//delete message from buffer:
+	recv_buffer.consume(4 + size);
+
+	return true;
+}
+
 //-----------------------------------------
 
-Game::Game() : mt(0x15466666) {
-	map_setup();
+PlayerTable::PlayerTable() {
+	key_index.fill(NoIndex);
+	key_generation.fill(1);
 }
 
-Player *Game::spawn_player() {
-	players.emplace_back();
-	Player &player = players.back();
+PlayerTable::Handle PlayerTable::add() {
+	if (size() >= MaxPlayers) throw std::runtime_error("Can't have more than " + std::to_string(MaxPlayers) + " players.");
+	uint32_t key = 0;
+	while (key_index[key] != NoIndex) ++key;
+	assert(key < MaxPlayers);
+
+	uint32_t index = size();
+	for_each_array([](auto &array){ array.emplace_back(); });
+	handle[index] = (key_generation[key] << 8) | key;
+	key_index[key] = index;
+	return handle[index];
+}
+
+void PlayerTable::remove(Handle player) {
+	uint32_t at = index(player);
+	assert(at != NoIndex);
+
+	retire(player);
+	for_each_array([at](auto &array){ array.erase(array.begin() + at); });
+	reindex(at, size());
+}
+
+uint32_t PlayerTable::index(Handle player) const {
+	uint32_t key = player & 0xff;
+	uint32_t at = key_index[key];
+	if (at == NoIndex || handle[at] != player) return NoIndex;
+	return at;
+}
+
+void PlayerTable::move_to_front(uint32_t at) {
+	assert(at < size());
+	for_each_array([at](auto &array){ std::rotate(array.begin(), array.begin() + at, array.begin() + at + 1); });
+	reindex(0, at + 1);
+}
+
+void PlayerTable::assign(PlayerStates const &states) {
+	for (Handle player : handle) {
+		retire(player);
+	}
+	static_cast< PlayerStates & >(*this) = states;
+	acked_snapshot.assign(size(), 0);
+	at.assign(size(), WalkPoint());
+	last_input.assign(size(), 0);
+	pending_inputs.assign(size(), PendingInputs());
+	input_budget.assign(size(), 0.0f);
+	view.assign(size(), 0);
+	handle.resize(size());
+	for (uint32_t key = 0; key < size(); ++key) {
+		handle[key] = (key_generation[key] << 8) | key;
+		key_index[key] = key;
+	}
+}
+
+void PlayerTable::retire(Handle player) {
+	//(generations are 24 bits, and skip 0 so that no handle equals NoHandle)
+	uint32_t key = player & 0xff;
+	key_index[key] = NoIndex;
+	key_generation[key] = (key_generation[key] + 1) & 0xffffff;
+	if (key_generation[key] == 0) key_generation[key] = 1;
+}
+
+void PlayerTable::reindex(uint32_t begin, uint32_t end) {
+	for (uint32_t i = begin; i < end; ++i) {
+		key_index[handle[i] & 0xff] = i;
+	}
+}
+
+//-----------------------------------------
+
+Game::Game() : Game(Board::Config()) {
+}
+
+Game::Game(Board::Config const &board_config) : mt(uint32_t(board_config.seed ^ (board_config.seed >> 32))), board(board_config) {
+	if (board.config.cell_size < CatchDistance + PlayerSpeed * Tick * float(MaxRewindTicks)) {
+		throw std::runtime_error("Board cells must be at least CatchDistance (plus MaxRewindTicks of walking) across.");
+	}
+	// don't set mines on start positions
+	for (auto const &pos : start_pos) {
+		board.safe_cells.emplace_back(board.cell_at(glm::vec2(pos)));
+	}
+}
+
+PlayerTable::Handle Game::spawn_player() {
+	PlayerTable::Handle handle = players.add();
+	uint32_t player = players.index(handle);
 
 	//random point in the middle area of the arena:
+	glm::vec3 &start_position = players.start_position[player];
 	for (auto &pos: start_pos) {
 		if (pos.w == 0.0f) {
 			pos.w = 1.0f;
-			player.start_position = glm::vec3(pos);
-			// std::cout << player.start_position.x << " " << player.start_position.y << " " << player.start_position.z << std::endl;
+			start_position = glm::vec3(pos);
+			// std::cout << start_position.x << " " << start_position.y << " " << start_position.z << std::endl;
 			break;
 		}
 	}
 
-	player.position = player.start_position;
-	player.current_state = pos_to_layout(player.position);
-	player.role = player.start_position.x > 0 ? Player::Role::HUNTER : Player::Role::PREY;
+	players.position[player] = start_position;
+	players.current_state[player] = pos_to_layout(start_position);
+	if (walkmesh) players.at[player] = walkmesh->nearest_walk_point(start_position);
+
+	//pick an id that no current player is using:
+	while (true) {
+		uint8_t id = uint8_t(next_player_number++);
+		bool used = false;
+		for (uint32_t i = 0; i < players.size(); ++i) {
+			if (i != player && players.id[i] == id) used = true;
+		}
+		if (!used) {
+			players.id[player] = id;
+			break;
+		}
+	}
+	players.role[player] = start_position.x > 0 ? Player::Role::HUNTER : Player::Role::PREY;
 
 	if (players.size() >= 2 && !is_clock_start) {
 		begin = std::chrono::steady_clock::now();
 		is_clock_start = true;
 	}
 
-	return &player;
+	return handle;
 }
 
-void Game::remove_player(Player *player) {
-	bool found = false;
-	for (auto pi = players.begin(); pi != players.end(); ++pi) {
-		if (&*pi == player) {
-			players.erase(pi);
-			for (auto &pos: start_pos) {
-				auto is_equal = [] (const glm::vec4 &v1, const glm::vec3 &v2) {
-					return v1.x == v2.x &&
-					       v1.y == v2.y &&
-						   v1.z == v2.z;
-				};
-				if (is_equal(pos, pi->start_position)) {
-					assert(pos.w != 0);
-					pos.w = 0;
-				}
-			}
-			found = true;
-			break;
+void Game::remove_player(PlayerTable::Handle player) {
+	uint32_t index = players.index(player);
+	assert(index != PlayerTable::NoIndex);
+	if (index == PlayerTable::NoIndex) return;
+
+	glm::vec3 start_position = players.start_position[index];
+	players.remove(player);
+	for (auto &pos: start_pos) {
+		auto is_equal = [] (const glm::vec4 &v1, const glm::vec3 &v2) {
+			return v1.x == v2.x &&
+			       v1.y == v2.y &&
+				   v1.z == v2.z;
+		};
+		if (is_equal(pos, start_position)) {
+			assert(pos.w != 0);
+			pos.w = 0;
 		}
 	}
 
 	if (players.size() < 2 && is_clock_start) {
 		is_clock_start = false;
 	}
-	assert(found);
 }
 
-void Game::map_setup() {
-	unsigned int mine_count = 10;
-
-	for (int i = 0; i < 10; i++)
-		for (int j = 0; j < 10; j++)
-			layout[i][j] = 0;
+// helper function
+int16_t Game::pos_to_layout(glm::vec3 player_pos) {
+	glm::ivec2 cell = board.cell_at(glm::vec2(player_pos));
+	if (!board.contains(cell)) return -2;
+	return board.cell(cell);
+}
 
-	// set up the mine
-	while (mine_count) {
-		unsigned int row, col;
-		row = mt() % 10;
-		col = mt() % 10;
+void Game::queue_input(PlayerTable::Handle player, Player::Input const &input) {
+	uint32_t index = players.index(player);
+	assert(index != PlayerTable::NoIndex);
+	if (index == PlayerTable::NoIndex) return;
 
-		// don't set mine on start position
-		if (row == 0 && col == 0) continue;
-		if (row == 9 && col == 9) continue;
+	PlayerTable::PendingInputs &pending = players.pending_inputs[index];
+	uint32_t newest = (pending.count ? pending.inputs[pending.count - 1].seq : players.last_input[index]);
+	if (input.seq <= newest) return;
 
-		if (layout[row][col] == 0) {
-			layout[row][col] = -1;
-			mine_count -= 1;
-		}
+	//if the client is far ahead, drop the oldest input to make room:
+	if (pending.count == PlayerTable::MaxPendingInputs) {
+		std::move(pending.inputs.begin() + 1, pending.inputs.end(), pending.inputs.begin());
+		pending.count -= 1;
 	}
-
-	// return 1 if there is a mine in given index
-	auto get_layout = [this](int i, int j) {
-		if (i >= 0 && i < 10 && j >= 0 && j < 10) 
-			return layout[i][j] == -1;
-		else
-			return false;
-	};
-
-	// then other cells
-	for (int i = 0; i < 10; i++) {
-		for (int j = 0; j < 10; j++) {
-			if (layout[i][j] == -1) continue;
-
-			assert(layout[i][j] == 0);
-			layout[i][j] += get_layout(i-1, j-1) + get_layout(i, j-1) + get_layout(i-1, j)
-						  + get_layout(i+1, j+1) + get_layout(i, j+1) + get_layout(i+1, j)
-						  + get_layout(i+1, j-1) + get_layout(i-1, j+1);
-		}
+	Player::Input &queued = pending.inputs[pending.count++];
+	queued = input;
+
+	//the view arrives as its low bits; it's the value closest to (and not after) the snapshot being made now:
+	if (queued.view != 0) {
+		constexpr uint32_t Mask = (1 << Player::ViewBits) - 1;
+		uint32_t now = next_snapshot_seq * Player::ViewSteps;
+		uint32_t behind = (now - queued.view) & Mask;
+		if (behind > Mask / 2) behind = 0; //(wrapped: a view ahead of the server, which shouldn't happen)
+		queued.view = (behind < now ? now - behind : 0);
 	}
 }
 
-// helper function
-int16_t Game::pos_to_layout(glm::vec3 player_pos) {
-	// checker board has grid_size * grid_size grid cells
-	const unsigned int grid_size = 10;
-	const unsigned int grid_cell_size = 4;
-
-	const glm::vec3 origin = glm::vec3(-20.0f, -20.0f, 0.0f);
+glm::vec3 Game::rewound_position(uint32_t player, uint32_t view) const {
+	glm::vec3 const &current = players.position[player];
+	if (view == 0) return current;
 
-	// define initial player position (also defined in)
-	glm::vec2 offset = glm::vec2(player_pos - origin);
+	//players' positions now will be the next snapshot recorded:
+	uint32_t now = next_snapshot_seq * Player::ViewSteps;
+	uint32_t max_rewind = std::min(now, MaxRewindTicks * Player::ViewSteps);
+	view = std::clamp(view, now - max_rewind, now);
 
-	glm::uvec2 quantized_offset = glm::vec2(floor(offset.x)/grid_cell_size, floor(offset.y)/grid_cell_size);
-	quantized_offset.x = quantized_offset.x >= grid_size? grid_size - 1 : quantized_offset.x;
-	quantized_offset.y = quantized_offset.y >= grid_size? grid_size - 1 : quantized_offset.y;
-
-	const glm::uvec2 start_layout = glm::uvec2(0, grid_size - 1);
-	glm::uint row = start_layout.y - quantized_offset.y;
-	glm::uint col = start_layout.x + quantized_offset.x;
-
-	auto is_valid = [grid_size](glm::uint index) {
-		return index >= 0 && index < grid_size;
+	//position at a snapshot (looked up by id, since the player may have been elsewhere in the table then):
+	auto position_at = [&](uint32_t seq, glm::vec3 *position) {
+		if (seq == next_snapshot_seq) {
+			*position = current;
+			return true;
+		}
+		Snapshot const *snapshot = find_snapshot(seq);
+		if (!snapshot) return false;
+		int32_t index = snapshot->find(players.id[player]);
+		if (index < 0) return false;
+		*position = snapshot->players.position[index];
+		return true;
 	};
 
-	if (!is_valid(row) || !is_valid(col)) return -2;
+	//blend between the snapshots around the view time (as the client did, when drawing):
+	uint32_t seq = view / Player::ViewSteps;
+	float amt = float(view % Player::ViewSteps) / float(Player::ViewSteps);
+	glm::vec3 before, after;
+	if (!position_at(seq, &before)) return current;
+	if (amt == 0.0f || !position_at(seq + 1, &after)) return before;
+	return glm::mix(before, after, amt);
+}
 
-	return layout[row][col];
+uint32_t Game::collision_bucket(glm::ivec2 cell) const {
+	//(collision_bucket_starts has an entry per bucket plus one, and the bucket count is a power of two)
+	uint32_t hash = uint32_t(cell.x) * 73856093u ^ uint32_t(cell.y) * 19349663u;
+	return hash & uint32_t(collision_bucket_starts.size() - 2);
 }
 
 void Game::update(float elapsed) {	
@@ -185,148 +405,434 @@ void Game::update(float elapsed) {
 		std::chrono::duration_cast<std::chrono::seconds>
 		(std::chrono::steady_clock::now() - begin).count();
 
+	uint32_t count = players.size();
+
 	if (since_begin == 40) {
-		for (auto &p : players) {
-			if (p.role == Player::Role::PREY) 
-				p.current_state = -3;
+		for (uint32_t p = 0; p < count; ++p) {
+			if (players.role[p] == Player::Role::PREY) 
+				players.current_state[p] = -3;
 			else 
-				p.current_state = -1;
+				players.current_state[p] = -1;
 		}
 		return;
 	}
 
-	//position/velocity update:
-	for (auto &p : players) {
-		p.current_state = pos_to_layout(p.position);
-
-		// resolve collision
-		for (auto &p2: players) {
-			if (&p == &p2) break;
-
-			const float threshold = 1.0f;
-			if (glm::distance(p.position, p2.position) < threshold) {
-				if (p.role == Player::Role::HUNTER) {
-					// win
-					p.current_state = -3;
-				}
-				else {
-					// lose
-					p.current_state = -1;
+	//walk players with their clients' inputs:
+	// (in rounds: round r walks every player's r'th input together, with one WalkMesh::step_batch call over players.at;
+	//  players with no r'th input take a zero step, which leaves them in place)
+	if (walkmesh) {
+		walk_applying.resize(count);
+		uint32_t rounds = 0;
+		for (uint32_t p = 0; p < count; ++p) {
+			float &budget = players.input_budget[p];
+			budget = std::min(budget + elapsed / Tick, MaxInputBudget);
+			walk_applying[p] = std::min(players.pending_inputs[p].count, uint32_t(budget));
+			budget -= float(walk_applying[p]);
+			rounds = std::max(rounds, walk_applying[p]);
+		}
+		walk_steps.resize(count);
+		for (uint32_t round = 0; round < rounds; ++round) {
+			for (uint32_t p = 0; p < count; ++p) {
+				if (round < walk_applying[p]) {
+					Player::Input const &input = players.pending_inputs[p].inputs[round];
+					walk_steps[p] = Player::input_step(input);
+					players.last_input[p] = input.seq;
+					players.view[p] = input.view;
+				} else {
+					walk_steps[p] = glm::vec3(0.0f);
 				}
 			}
+			walkmesh->step_batch(players.at.data(), walk_steps.data(), count);
 		}
+		for (uint32_t p = 0; p < count; ++p) {
+			PlayerTable::PendingInputs &pending = players.pending_inputs[p];
+			uint32_t applied = walk_applying[p];
+			std::move(pending.inputs.begin() + applied, pending.inputs.begin() + pending.count, pending.inputs.begin());
+			pending.count -= applied;
+			players.position[p] = walkmesh->to_world_point(players.at[p]);
+		}
+	}
 
-		if (p.current_state == -1 || p.current_state == -3) {
-			for (auto &p3 : players) {
-				if (&p == &p3) break;
+	//board state under each player; also bucket players by cell (counting sort) for catch detection:
+	uint32_t bucket_count = 1;
+	while (bucket_count < 2 * count) bucket_count *= 2;
+	collision_bucket_starts.assign(bucket_count + 1, 0);
+	collision_player_cells.resize(count);
+	for (uint32_t p = 0; p < count; ++p) {
+		players.current_state[p] = pos_to_layout(players.position[p]);
+		glm::ivec2 cell = board.cell_at(glm::vec2(players.position[p]));
+		collision_player_cells[p] = cell;
+		collision_bucket_starts[collision_bucket(cell) + 1] += 1;
+	}
+	for (uint32_t b = 0; b < bucket_count; ++b) {
+		collision_bucket_starts[b + 1] += collision_bucket_starts[b];
+	}
+	collision_bucket_players.resize(count);
+	{ //(uses the bucket ends as insertion points, then shifts them back to be starts)
+		for (uint32_t p = 0; p < count; ++p) {
+			collision_bucket_players[collision_bucket_starts[collision_bucket(collision_player_cells[p])]++] = p;
+		}
+		for (uint32_t b = bucket_count; b > 0; --b) {
+			collision_bucket_starts[b] = collision_bucket_starts[b - 1];
+		}
+		collision_bucket_starts[0] = 0;
+	}
 
-				if (p.current_state == -1) p3.current_state = -3;
-				if (p.current_state == -3) p3.current_state = -1;
+	// resolve collision: each hunter checks for prey in its own and neighbouring cells,
+	// with prey where the hunter's client was showing them (see MaxRewindTicks)
+	for (uint32_t hunter = 0; hunter < count; ++hunter) {
+		if (players.role[hunter] != Player::Role::HUNTER) continue;
+		uint32_t view = players.view[hunter];
+		for (int32_t dy = -1; dy <= 1; ++dy) {
+			for (int32_t dx = -1; dx <= 1; ++dx) {
+				glm::ivec2 cell = collision_player_cells[hunter] + glm::ivec2(dx, dy);
+				uint32_t b = collision_bucket(cell);
+				for (uint32_t i = collision_bucket_starts[b]; i < collision_bucket_starts[b + 1]; ++i) {
+					uint32_t prey = collision_bucket_players[i];
+					//(buckets may also hold other cells' players)
+					if (collision_player_cells[prey] != cell) continue;
+					if (players.role[prey] == Player::Role::HUNTER) continue;
+					glm::vec3 between = rewound_position(prey, view) - players.position[hunter];
+					if (glm::dot(between, between) < CatchDistance * CatchDistance) {
+						players.current_state[hunter] = -3; // win
+						players.current_state[prey] = -1; // lose
+					}
+				}
 			}
+		}
+	}
 
+	//the first player (in table order) to win or lose -- by a catch or a mine -- ends the round:
+	// their side shares their result and the other side gets the opposite
+	for (uint32_t p = 0; p < count; ++p) {
+		int16_t result = players.current_state[p];
+		if (result == -1 || result == -3) {
+			Player::Role role = players.role[p];
+			for (uint32_t p2 = 0; p2 < count; ++p2) {
+				if (players.role[p2] == role) players.current_state[p2] = result;
+				else players.current_state[p2] = (result == -1 ? -3 : -1);
+			}
 			break;
 		}
 	}
 }
 
 
-void Game::send_state_message(Connection *connection_, Player *connection_player) const {
+void Game::record_snapshot() {
+	Snapshot &snapshot = spare_snapshot;
+
+	snapshot.seq = next_snapshot_seq++;
+	snapshot.since_begin = since_begin;
+	snapshot.players = players; //(copies just the PlayerStates part, into already-allocated arrays)
+	snapshot.index_of_id.fill(-1);
+	for (uint32_t i = 0; i < snapshot.players.size(); ++i) {
+		snapshot.index_of_id[snapshot.players.id[i]] = int16_t(i);
+	}
+
+	push_spare_snapshot();
+}
+
+void Game::push_spare_snapshot() {
+	snapshots.emplace_back(std::move(spare_snapshot));
+	if (snapshots.size() > SnapshotHistory) {
+		spare_snapshot = std::move(snapshots.front());
+		snapshots.pop_front();
+	}
+}
+
+Snapshot const *Game::find_snapshot(uint32_t seq) const {
+	if (seq == 0) return nullptr;
+	for (auto s = snapshots.rbegin(); s != snapshots.rend(); ++s) {
+		if (s->seq == seq) return &*s;
+		if (s->seq < seq) break;
+	}
+	return nullptr;
+}
+
+Connection::Block Game::make_state_block(uint32_t baseline_seq, bool *important) const {
+	assert(!snapshots.empty() && "must record_snapshot() before sending state");
+	Snapshot const &current = snapshots.back();
+	Snapshot const *baseline = find_snapshot(baseline_seq);
+
+	auto block = std::make_shared< std::vector< uint8_t > >();
+	BitWriter writer(block.get());
+
+	//snapshot numbers; client decodes relative to its copy of the baseline:
+	writer.write_bits(current.seq, 32);
+	writer.write_bits(baseline ? baseline->seq : 0, 32);
+
+	//game clock, only if changed:
+	bool clock_changed = (!baseline || baseline->since_begin != current.since_begin);
+	writer.write_bool(clock_changed);
+	if (clock_changed) writer.write_bits(uint32_t(int32_t(current.since_begin)), 32);
+
+	//player ids:
+	assert(current.players.size() <= 255);
+	uint32_t count = uint32_t(current.players.size());
+	writer.write_bits(count, 8);
+	for (uint32_t i = 0; i < count; ++i) {
+		writer.write_bits(current.players.id[i], 8);
+	}
+
+	//change masks:
+	PlayerStates const &now = current.players;
+	std::array< uint8_t, 256 > masks;
+	for (uint32_t i = 0; i < count; ++i) {
+		int32_t b = (baseline ? baseline->find(now.id[i]) : -1);
+		uint8_t &mask = masks[i];
+		if (b < 0) {
+			mask = ChangedAll;
+		} else {
+			PlayerStates const &base = baseline->players;
+			mask = 0;
+			if (glm::vec2(base.position[b]) != glm::vec2(now.position[i])) mask |= ChangedPosition;
+			if (base.position[b].z != now.position[i].z) mask |= ChangedHeight;
+			if (base.start_position[b] != now.start_position[i]) mask |= ChangedStartPosition;
+			if (base.current_state[b] != now.current_state[i]) mask |= ChangedState;
+			if (base.role[b] != now.role[i]) mask |= ChangedRole;
+		}
+		writer.write_bits(mask, ChangeMaskBits);
+	}
+
+	if (important) {
+		*important = !baseline;
+		for (uint32_t i = 0; i < count; ++i) {
+			int16_t state = now.current_state[i];
+			if (masks[i] & ChangedRole) *important = true;
+			if ((masks[i] & ChangedState) && (state == -1 || state == -3)) *important = true;
+		}
+	}
+
+	//changed fields:
+	for (uint32_t i = 0; i < count; ++i) {
+		if (masks[i] & ChangedPosition) {
+			writer.write_quantized(now.position[i].x, Player::PositionMin.x, Player::PositionMax.x, Player::PositionBits);
+			writer.write_quantized(now.position[i].y, Player::PositionMin.y, Player::PositionMax.y, Player::PositionBits);
+		}
+		if (masks[i] & ChangedHeight) writer.write_quantized(now.position[i].z, Player::PositionMin.z, Player::PositionMax.z, Player::HeightBits);
+		if (masks[i] & ChangedStartPosition) {
+			writer.write_quantized(now.start_position[i].x, Player::PositionMin.x, Player::PositionMax.x, Player::PositionBits);
+			writer.write_quantized(now.start_position[i].y, Player::PositionMin.y, Player::PositionMax.y, Player::PositionBits);
+			writer.write_quantized(now.start_position[i].z, Player::PositionMin.z, Player::PositionMax.z, Player::HeightBits);
+		}
+		if (masks[i] & ChangedState) writer.write_ranged(now.current_state[i], Player::StateMin, Player::StateMax);
+		if (masks[i] & ChangedRole) writer.write_bool(now.role[i] == Player::Role::HUNTER);
+	}
+
+	writer.flush();
+
+	return block;
+}
+
+void Game::send_state_message(Connection *connection_, Connection::Block const &state_block, uint8_t player_index, uint32_t last_input, Connection::Channel channel) {
 	assert(connection_);
 	auto &connection = *connection_;
-
-	connection.send(Message::S2C_State);
-
-	//will patch message size in later, for now placeholder bytes:
-	connection.send(uint8_t(0));
-	connection.send(uint8_t(0));
-	connection.send(uint8_t(0));
-	size_t mark = connection.send_buffer.size(); //keep track of this position in the buffer
-
-	//send player info helper:
-	auto send_player = [&](Player const &player) {
-		connection.send(player.position);
-		connection.send(player.start_position);
-		connection.send(player.current_state);
-		connection.send(player.role);
-		connection.send(since_begin);
-		// connection.send(player.velocity);
-		// connection.send(player.color);
-	
-		//NOTE: can't just 'send(name)' because player.name is not plain-old-data type.
-		//effectively: truncates player name to 255 chars
-		// uint8_t len = uint8_t(std::min< size_t >(255, player.name.size()));
-		// connection.send(len);
-		// connection.send_buffer.insert(connection.send_buffer.end(), player.name.begin(), player.name.begin() + len);
+	assert(state_block);
+
+	//message size covers the per-connection header and the shared block:
+	uint32_t size = uint32_t(1 + 4 + state_block->size());
+	assert(size < (1 << 24));
+
+	uint8_t header[9] = {
+		uint8_t(Message::S2C_State),
+		uint8_t(size),
+		uint8_t(size >> 8),
+		uint8_t(size >> 16),
+		player_index, //which player in the list belongs to this connection
+		//latest input of that player applied so far (so the client can replay the ones after it):
+		uint8_t(last_input),
+		uint8_t(last_input >> 8),
+		uint8_t(last_input >> 16),
+		uint8_t(last_input >> 24)
 	};
 
-	//player count:
-	assert(players.size() <= 255);
-	connection.send(uint8_t(players.size()));
-	// send the connection player before every other players
-	if (connection_player) send_player(*connection_player);
-	for (auto const &player : players) {
-		if (&player == connection_player) continue;
-		send_player(player);
+	//shared snapshot body is queued by reference, not copied:
+	if (channel == Connection::Unreliable) {
+		connection.send_unreliable(header, sizeof(header), state_block);
+	} else {
+		connection.send_raw(header, sizeof(header));
+		connection.send_block(state_block);
+	}
+}
+
+void Game::make_state_messages(std::vector< PlayerTable::Handle > const &recipients, std::vector< StateMessage > *messages_) {
+	assert(messages_);
+	auto &messages = *messages_;
+
+	record_snapshot();
+	uint32_t current_seq = snapshots.back().seq;
+
+	//snapshot bodies by baseline (most clients will have acked one of the last few snapshots, so a linear search is fine):
+	state_bodies.clear();
+
+	messages.clear();
+	messages.reserve(recipients.size());
+	for (PlayerTable::Handle player : recipients) {
+		uint32_t index = players.index(player);
+		uint32_t acked = (index != PlayerTable::NoIndex ? players.acked_snapshot[index] : 0);
+		uint32_t baseline_seq = (find_snapshot(acked) ? acked : 0);
+		assert(baseline_seq < current_seq);
+		auto f = std::find_if(state_bodies.begin(), state_bodies.end(), [&](auto const &body){ return body.first == baseline_seq; });
+		if (f == state_bodies.end()) {
+			StateMessage body;
+			body.body = make_state_block(baseline_seq, &body.important);
+			state_bodies.emplace_back(baseline_seq, std::move(body));
+			f = state_bodies.end() - 1;
+		}
+		messages.emplace_back(f->second);
+		messages.back().player_index = (index != PlayerTable::NoIndex ? uint8_t(index) : NoPlayerIndex);
+		messages.back().last_input = (index != PlayerTable::NoIndex ? players.last_input[index] : 0);
+	}
+
+	//(don't hold on to the bodies past this tick)
+	state_bodies.clear();
+}
+
+void Game::send_state_message(Connection *connection, StateMessage const &message) {
+	//joins, role changes, and game over go over TCP; everything else is superseded by the next tick's snapshot anyway:
+	send_state_message(connection, message.body, message.player_index, message.last_input,
+		(message.important ? Connection::Reliable : Connection::Unreliable));
+}
+
+void Game::send_state_messages(std::unordered_map< Connection *, PlayerTable::Handle > const &connection_to_player) {
+	std::vector< PlayerTable::Handle > recipients;
+	recipients.reserve(connection_to_player.size());
+	for (auto const &[connection, player] : connection_to_player) {
+		recipients.emplace_back(player);
+	}
+
+	std::vector< StateMessage > messages;
+	make_state_messages(recipients, &messages);
+
+	size_t i = 0;
+	for (auto const &[connection, player] : connection_to_player) {
+		send_state_message(connection, messages[i]);
+		++i;
 	}
+}
+
+void Game::send_ack_message(Connection *connection_, Connection::Channel channel) const {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	if (snapshots.empty()) return;
+
+	uint32_t size = sizeof(uint32_t);
+	uint8_t message[4 + sizeof(uint32_t)] = {
+		uint8_t(Message::C2S_Ack),
+		uint8_t(size),
+		uint8_t(size >> 8),
+		uint8_t(size >> 16),
+	};
+	std::memcpy(message + 4, &snapshots.back().seq, sizeof(uint32_t));
 
-	//compute the message size and patch into the message header:
-	uint32_t size = uint32_t(connection.send_buffer.size() - mark);
-	connection.send_buffer[mark-3] = uint8_t(size);
-	connection.send_buffer[mark-2] = uint8_t(size >> 8);
-	connection.send_buffer[mark-1] = uint8_t(size >> 16);
+	if (channel == Connection::Unreliable) connection.send_unreliable(message, sizeof(message));
+	else connection.send_raw(message, sizeof(message));
 }
 
 bool Game::recv_state_message(Connection *connection_) {
 	assert(connection_);
 	auto &connection = *connection_;
-	auto &recv_buffer = connection.recv_buffer;
+
+	return recv_state_message(connection.recv_buffer) || recv_state_message(connection.unreliable_recv_buffer);
+}
+
+bool Game::recv_state_message(ByteQueue &recv_buffer) {
 
 	if (recv_buffer.size() < 4) return false;
 	if (recv_buffer[0] != uint8_t(Message::S2C_State)) return false;
 	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
 	              | (uint32_t(recv_buffer[2]) << 8)
 	              |  uint32_t(recv_buffer[1]);
-	uint32_t at = 0;
 	//expecting complete message:
 	if (recv_buffer.size() < 4 + size) return false;
 
-	//copy bytes from buffer and advance position:
-	auto read = [&](auto *val) {
-		if (at + sizeof(*val) > size) {
-			throw std::runtime_error("Ran out of bytes reading state message.");
+	BitReader reader(recv_buffer.data() + 4, size);
+
+	uint8_t player_index = uint8_t(reader.read_bits(8));
+	uint32_t message_last_input = reader.read_bits(32);
+
+	//(decoded into the spare snapshot, so storage is reused rather than allocated for every message)
+	Snapshot &snapshot = spare_snapshot;
+	snapshot.seq = reader.read_bits(32);
+	uint32_t baseline_seq = reader.read_bits(32);
+
+	//state may arrive over both channels, so an older snapshot can show up after a newer one; newest wins:
+	if (!snapshots.empty() && snapshot.seq <= snapshots.back().seq) {
+		recv_buffer.consume(4 + size);
+		return true;
+	}
+	Snapshot const *baseline = find_snapshot(baseline_seq);
+	if (baseline_seq != 0 && !baseline) {
+		throw std::runtime_error("State message relative to unknown snapshot " + std::to_string(baseline_seq) + ".");
+	}
+
+	bool clock_changed = reader.read_bool();
+	if (clock_changed) snapshot.since_begin = int32_t(reader.read_bits(32));
+	else if (baseline) snapshot.since_begin = baseline->since_begin;
+	else throw std::runtime_error("Full state message without game clock.");
+
+	uint32_t player_count = reader.read_bits(8);
+	PlayerStates &states = snapshot.players;
+	states.resize(player_count);
+	snapshot.index_of_id.fill(-1);
+	std::array< bool, 256 > in_baseline;
+	for (uint32_t i = 0; i < player_count; ++i) {
+		uint8_t id = uint8_t(reader.read_bits(8));
+		if (snapshot.index_of_id[id] != -1) throw std::runtime_error("Duplicated player id in state message.");
+		snapshot.index_of_id[id] = int16_t(i);
+		//start from baseline state, if player was in baseline:
+		int32_t base = (baseline ? baseline->find(id) : -1);
+		in_baseline[i] = (base >= 0);
+		if (in_baseline[i]) states.copy(i, baseline->players, uint32_t(base));
+		states.id[i] = id;
+	}
+
+	std::array< uint8_t, 256 > masks;
+	for (uint32_t i = 0; i < player_count; ++i) {
+		masks[i] = uint8_t(reader.read_bits(ChangeMaskBits));
+	}
+
+	for (uint32_t i = 0; i < player_count; ++i) {
+		if (!in_baseline[i]) {
+			//players not in the baseline must be sent in full:
+			if (masks[i] != ChangedAll) {
+				throw std::runtime_error("Partial state for new player in state message.");
+			}
 		}
-		std::memcpy(val, &recv_buffer[4 + at], sizeof(*val));
-		at += sizeof(*val);
-	};
+		if (masks[i] & ChangedPosition) {
+			states.position[i].x = reader.read_quantized(Player::PositionMin.x, Player::PositionMax.x, Player::PositionBits);
+			states.position[i].y = reader.read_quantized(Player::PositionMin.y, Player::PositionMax.y, Player::PositionBits);
+		}
+		if (masks[i] & ChangedHeight) states.position[i].z = reader.read_quantized(Player::PositionMin.z, Player::PositionMax.z, Player::HeightBits);
+		if (masks[i] & ChangedStartPosition) {
+			states.start_position[i].x = reader.read_quantized(Player::PositionMin.x, Player::PositionMax.x, Player::PositionBits);
+			states.start_position[i].y = reader.read_quantized(Player::PositionMin.y, Player::PositionMax.y, Player::PositionBits);
+			states.start_position[i].z = reader.read_quantized(Player::PositionMin.z, Player::PositionMax.z, Player::HeightBits);
+		}
+		if (masks[i] & ChangedState) states.current_state[i] = int16_t(reader.read_ranged(Player::StateMin, Player::StateMax));
+		if (masks[i] & ChangedRole) states.role[i] = (reader.read_bool() ? Player::Role::HUNTER : Player::Role::PREY);
+		// velocity = ...;
+		// color = ...;
+	}
+
+	reader.finish();
+
+	if (player_index != NoPlayerIndex && player_index >= player_count) throw std::runtime_error("Out-of-range player index in state message.");
 
-	players.clear();
-	uint8_t player_count;
-	read(&player_count);
-	for (uint8_t i = 0; i < player_count; ++i) {
-		players.emplace_back();
-		Player &player = players.back();
-		read(&player.position);
-		read(&player.start_position);
-		read(&player.current_state);
-		read(&player.role);
-		read(&since_begin);
-		// read(&player.velocity);
-		// read(&player.color);
-		// uint8_t name_len;
-		// read(&name_len);
-		//n.b. would probably be more efficient to directly copy from recv_buffer, but I think this is clearer:
-		// player.name = "";
-		// for (uint8_t n = 0; n < name_len; ++n) {
-		// 	char c;
-		// 	read(&c);
-		// 	player.name += c;
-		// }
-	}
-
-	if (at != size) throw std::runtime_error("Trailing data in state message.");
+	//keep the snapshot around as a possible baseline for later messages:
+	since_begin = snapshot.since_begin;
+	last_input = message_last_input;
+	players.assign(states);
+	push_spare_snapshot();
+
+	//move this client's player to the front of the table:
+	if (player_index != NoPlayerIndex) {
+		players.move_to_front(player_index);
+	}
 
 	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	recv_buffer.consume(4 + size);
 
 	return true;
 }
@@ -1,22 +1,29 @@
 #pragma once
 
+#include "Connection.hpp"
+#include "Board.hpp"
+#include "WalkMesh.hpp"
+
 #include <glm/glm.hpp>
 
 #include <string>
-#include <list>
+#include <unordered_map>
+#include <deque>
+#include <vector>
 #include <array>
 #include <random>
 #include <chrono>
 
-struct Connection;
-
 //Game state, separate from rendering.
 
-//Currently set up for a "client sends controls" / "server sends whole state" situation.
+//Currently set up for a "client sends controls" / "server sends whole state" situation:
+// the server walks every player with the controls their client sends; clients predict their own player's
+// movement from the same controls, and correct the prediction when the server's state disagrees.
 
 enum class Message : uint8_t {
-	C2S_PlayerPos = 1,
+	C2S_Controls = 1,
 	S2C_State = 2,
+	C2S_Ack = 3, //client has received the state snapshot with the given sequence number
 };
 
 //used to represent a control input:
@@ -32,6 +39,34 @@ struct Player {
 		Button left, right, up, down, jump;
 	} controls;
 
+	//controls as sampled once per Game::Tick and sent to the server:
+	struct Input {
+		uint32_t seq = 0; //numbered from 1 by the client, one per tick of controls
+		uint8_t buttons = 0; //which buttons were pressed (bits below)
+		float yaw = 0.0f; //facing (radians around +z) that the buttons move relative to
+		//(for lag compensation) server time the client was drawing other players at, in 1/ViewSteps ticks (0 if none):
+		// (only the low ViewBits bits are sent; the server's Game::queue_input fills in the rest)
+		uint32_t view = 0;
+	};
+	inline static constexpr uint32_t ViewSteps = 16;
+	inline static constexpr uint32_t ViewBits = 16;
+	//view time (in 1/ViewSteps ticks) of a server time given in seconds:
+	static uint32_t view_of_time(double time);
+	enum : uint8_t {
+		ButtonLeft = 1,
+		ButtonRight = 2,
+		ButtonUp = 4,
+		ButtonDown = 8,
+		ButtonJump = 16,
+	};
+	//sample current controls (with facing quantized the way the server will see it):
+	Input sample_input(uint32_t seq, float yaw) const;
+	//world-space step an input makes over one Game::Tick (before following the walkmesh):
+	static glm::vec3 input_step(Input const &input);
+
+	//(client) inputs the server hasn't applied yet, oldest first; (server) inputs from the last controls message
+	std::vector< Input > inputs;
+
 	//player state (sent from server):
 	// glm::vec2 position = glm::vec2(0.0f, 0.0f);
 	// glm::vec2 velocity = glm::vec2(0.0f, 0.0f);
@@ -47,32 +82,173 @@ struct Player {
 		HUNTER = 2,
 	};
 
-	Role role;
+	Role role = Role::PREY;
+
+	//identifies the player across state snapshots (assigned by server, unique among current players):
+	uint8_t id = 0;
+
+	//wire encoding (see BitStream.hpp):
+	//positions are quantized over [PositionMin, PositionMax] (x,y cover the +/-20 arena), to PositionBits for x,y and HeightBits for z:
+	// (z rarely changes, so state messages send it separately, only when it does)
+	inline static constexpr glm::vec3 PositionMin = glm::vec3(-20.0f, -20.0f, -8.0f);
+	inline static constexpr glm::vec3 PositionMax = glm::vec3( 20.0f,  20.0f,  8.0f);
+	inline static constexpr uint32_t PositionBits = 14;
+	inline static constexpr uint32_t HeightBits = 10;
+	//controls messages carry the newest (up to) MaxInputsPerMessage of the unapplied inputs,
+	// so each input is repeated until the server applies it, and a lost datagram doesn't lose any input:
+	inline static constexpr uint32_t MaxInputsPerMessage = 16;
+	inline static constexpr uint32_t ButtonBits = 5;
+	inline static constexpr uint32_t YawBits = 16;
+	static uint32_t controls_message_size(uint32_t input_count);
+	//current_state is a neighbour count (0-8) or one of the special values -1 (lost), -2 (off board), -3 (won):
+	inline static constexpr int32_t StateMin = -3;
+	inline static constexpr int32_t StateMax = 8;
+
+	//(server only) latest snapshot the player's client has acknowledged, or 0 if none:
+	uint32_t acked_snapshot = 0;
 
 	//returns 'false' if no message or not a controls message,
-	//returns 'true' if read a controls message,
+	//returns 'true' if read a controls message (into 'inputs'),
 	//throws on malformed controls message
-	void send_player_message(Connection *connection) const;
-	bool recv_player_message(Connection *connection);
+	// (messages are read from the connection's recv_buffer, then from its unreliable_recv_buffer)
+	void send_controls_message(Connection *connection, Connection::Channel channel = Connection::Reliable) const;
+	bool recv_controls_message(Connection *connection);
+	bool recv_controls_message(ByteQueue &recv_buffer);
+
+	//(server only) same conventions as recv_controls_message, for C2S_Ack:
+	bool recv_ack_message(Connection *connection);
+	bool recv_ack_message(ByteQueue &recv_buffer);
+};
+
+//the parts of several players' state that are sent from server to client,
+// stored as one array per field (so loops over one field walk contiguous memory):
+struct PlayerStates {
+	std::vector< uint8_t > id;
+	std::vector< glm::vec3 > position;
+	std::vector< glm::vec3 > start_position;
+	std::vector< int16_t > current_state;
+	std::vector< Player::Role > role;
+
+	uint32_t size() const { return uint32_t(id.size()); }
+	bool empty() const { return id.empty(); }
+	//(only allocates when growing past the largest size so far)
+	void resize(uint32_t count) {
+		for_each_array([count](auto &array){ array.resize(count); });
+	}
+	//copy player 'from_index' of 'from' over player 'index':
+	void copy(uint32_t index, PlayerStates const &from, uint32_t from_index) {
+		id[index] = from.id[from_index];
+		position[index] = from.position[from_index];
+		start_position[index] = from.start_position[from_index];
+		current_state[index] = from.current_state[from_index];
+		role[index] = from.role[from_index];
+	}
+
+	//apply f to each field's array:
+	template< typename F >
+	void for_each_array(F &&f) {
+		f(id); f(position); f(start_position); f(current_state); f(role);
+	}
+};
+
+//the game's players: per-player state in dense arrays (PlayerStates, plus server-only fields),
+// with players kept in order and referred to from outside by handles that stay valid as other players come and go:
+struct PlayerTable : PlayerStates {
+	//handles combine a key (low 8 bits) that maps to the player's current index in the arrays,
+	// and a generation count, so that handles of removed players never refer to later players:
+	using Handle = uint32_t;
+	inline static constexpr Handle NoHandle = 0;
+	inline static constexpr uint32_t NoIndex = ~uint32_t(0);
+	inline static constexpr uint32_t MaxPlayers = 255; //(player ids are 8 bits)
+
+	//(server only) latest snapshot the player's client has acknowledged, or 0 if none:
+	std::vector< uint32_t > acked_snapshot;
+	//(server only) movement: where the player is on the walkmesh, the last input applied (0 if none),
+	// inputs received but not yet applied, and how many inputs may be applied before the next tick:
+	std::vector< WalkPoint > at;
+	std::vector< uint32_t > last_input;
+	inline static constexpr uint32_t MaxPendingInputs = 8;
+	struct PendingInputs {
+		std::array< Player::Input, MaxPendingInputs > inputs; //oldest first
+		uint32_t count = 0;
+	};
+	std::vector< PendingInputs > pending_inputs;
+	std::vector< float > input_budget;
+	//(server only) view time of the last input applied (see Player::Input::view), for lag compensation:
+	std::vector< uint32_t > view;
+	//handle of each player:
+	std::vector< Handle > handle;
+
+	PlayerTable();
+
+	//append a player (with default state) to the end of the table:
+	// (throws if the table already holds MaxPlayers players)
+	Handle add();
+	//remove a player, keeping the others in order:
+	void remove(Handle player);
+	//index of a player in the arrays, or NoIndex if the handle doesn't refer to a current player:
+	uint32_t index(Handle player) const;
+	//move a player to index 0, keeping the others in order:
+	void move_to_front(uint32_t index);
+	//replace all players with copies of 'states' (all existing handles stop referring to players):
+	void assign(PlayerStates const &states);
+
+	template< typename F >
+	void for_each_array(F &&f) {
+		PlayerStates::for_each_array(f);
+		f(acked_snapshot); f(at); f(last_input); f(pending_inputs); f(input_budget); f(view); f(handle);
+	}
+
+	//handle bookkeeping: index of each key's player (or NoIndex if key is unused) and its current generation:
+	std::array< uint32_t, 256 > key_index;
+	std::array< uint32_t, 256 > key_generation;
+	//free up a handle's key and advance its generation:
+	void retire(Handle player);
+	//point key_index back at players [begin,end) after they have moved:
+	void reindex(uint32_t begin, uint32_t end);
+};
+
+//copy of the game state as sent in one S2C_State message;
+// kept on both ends so later messages can be encoded relative to it:
+struct Snapshot {
+	uint32_t seq = 0; //starts at 1; 0 means "no snapshot"
+	int64_t since_begin = -1;
+	PlayerStates players; //in server's players-table order
+	std::array< int16_t, 256 > index_of_id; //player id -> index in players (or -1)
+
+	//index in players of player with the given id, or -1 if not present:
+	int32_t find(uint8_t id) const {
+		return index_of_id[id];
+	}
 };
 
 struct Game {
-	std::list< Player > players; //(using list so they can have stable addresses)
-	Player *spawn_player(); //add player the end of the players list (may also, e.g., play some spawn anim)
-	void remove_player(Player *); //remove player from game (may also, e.g., play some despawn anim)
+	PlayerTable players; //(hold on to handles rather than indices, since indices change as players come and go)
+	PlayerTable::Handle spawn_player(); //add player the end of the players table (may also, e.g., play some spawn anim)
+	void remove_player(PlayerTable::Handle); //remove player from game (may also, e.g., play some despawn anim)
 
-	std::mt19937 mt; //used for spawning players
+	std::mt19937 mt; //used for spawning players (seeded from the board's seed)
 	uint32_t next_player_number = 1; //used for naming players
 
 	std::chrono::steady_clock::time_point begin;
 	bool is_clock_start = false;
 	int64_t since_begin = -1;
 
-	Game();
+	Game(); //default board (10x10, matching the client's scene)
+	explicit Game(Board::Config const &board_config);
 
 	//state update function:
 	void update(float elapsed);
 
+	//(server) walkmesh players move on (players don't move if not set):
+	WalkMesh const *walkmesh = nullptr;
+	//(server) queue an input to be applied by a later update():
+	// (inputs arrive repeatedly and out of order; ones older than the newest queued or applied input are ignored)
+	void queue_input(PlayerTable::Handle player, Player::Input const &input);
+	//inputs are applied at most one per Tick (on average), so sending extra inputs can't speed a player up;
+	// some budget can be saved up to absorb inputs arriving in bunches:
+	inline static constexpr float MaxInputBudget = 4.0f;
+
 	//constants:
 	//the update rate on the server:
 	inline static constexpr float Tick = 1.0f / 30.0f;
@@ -83,7 +259,7 @@ struct Game {
 
 	//player constants:
 	inline static constexpr float PlayerRadius = 0.06f;
-	inline static constexpr float PlayerSpeed = 2.0f;
+	inline static constexpr float PlayerSpeed = 3.0f;
 	inline static constexpr float PlayerAccelHalflife = 0.25f;
 
 	//----------------- New ---------------------
@@ -95,12 +271,32 @@ struct Game {
 	// 	{0, 1, -1, 2}
 	// }};
 
-	std::array<std::array<int16_t, 10>, 10> layout;
-	void map_setup();
+	// mines and neighbour counts (generated as players reach each part of the board):
+	Board board;
 
 	// conversion between player pos and map grid
+	// (returns the board cell's value, or -2 if off the board)
 	int16_t pos_to_layout(glm::vec3 player_pos);
 
+	// a hunter this close to a prey catches them:
+	inline static constexpr float CatchDistance = 1.0f;
+	// lag compensation: a hunter catches prey where the hunter's client was showing them
+	// (the view time of the hunter's latest input, looked up in the snapshot history), as long as
+	// that's no more than MaxRewindTicks ago; clients claiming older views are treated as that far behind:
+	inline static constexpr uint32_t MaxRewindTicks = 15;
+	// position of a player at a view time (see Player::Input::view), or its current position if the view is 0 or not kept:
+	glm::vec3 rewound_position(uint32_t player_index, uint32_t view) const;
+	// catch detection hashes players by board cell (into a table sized by player count, not board size),
+	// so only players in neighbouring cells get compared:
+	// (requires board cells to be at least CatchDistance across, plus how far prey can walk in MaxRewindTicks)
+	uint32_t collision_bucket(glm::ivec2 cell) const;
+	// (scratch space for update(), kept to avoid allocating every tick)
+	std::vector< uint32_t > collision_bucket_starts; //players in bucket b are collision_bucket_players[starts[b], starts[b+1])
+	std::vector< uint32_t > collision_bucket_players; //(player indices)
+	std::vector< glm::ivec2 > collision_player_cells; //cell of each player, in players-table order
+	std::vector< uint32_t > walk_applying; //how many pending inputs each player applies this update
+	std::vector< glm::vec3 > walk_steps; //each player's step in the current round
+
 	// the last component (vec4.w) indicates whether
 	// the start pos has been used
 	// 0 - not used; anything else - used
@@ -115,11 +311,70 @@ struct Game {
 
 	//used by client:
 	//set game state from data in connection buffer
-	// (return true if data was read)
+	//  Will move the client's own player to the front of the players table.
+	// (return true if data was read; messages older than the latest one received are read but ignored)
 	bool recv_state_message(Connection *connection);
+	bool recv_state_message(ByteQueue &recv_buffer);
+
+	//(client) latest of this client's inputs the server had applied as of the latest snapshot:
+	uint32_t last_input = 0;
+
+	//used by client:
+	//acknowledge the latest received snapshot, so the server can encode later ones relative to it:
+	void send_ack_message(Connection *connection, Connection::Channel channel = Connection::Reliable) const;
 
 	//used by server:
-	//send game state.
-	//  Will move "connection_player" to the front of the front of the sent list.
-	void send_state_message(Connection *connection, Player *connection_player = nullptr) const;
+	//S2C_State is a short header naming the receiving connection's player and the last of its inputs applied,
+	// followed by a snapshot body that only depends on which baseline snapshot it is relative to.
+	//The body lists every player's id and a change mask; only fields that differ from the baseline are sent.
+	inline static constexpr uint8_t NoPlayerIndex = 0xff;
+	//record the current game state as the next snapshot (once per tick, before sending):
+	void record_snapshot();
+	//serialize the latest snapshot relative to 'baseline_seq' (full state if baseline is 0 or no longer kept):
+	// sets *important (if given) when the body is a full state or contains a role change or game-over state,
+	// which should be sent reliably rather than risk waiting for a later snapshot to repeat it
+	Connection::Block make_state_block(uint32_t baseline_seq, bool *important = nullptr) const;
+	//send game state, referencing an already-serialized snapshot body:
+	// (only touches the connection, so may be called from a different thread than the one updating the game)
+	static void send_state_message(Connection *connection, Connection::Block const &state_block, uint8_t player_index, uint32_t last_input, Connection::Channel channel = Connection::Reliable);
+
+	//one recipient's state message for a tick, ready to be sent:
+	struct StateMessage {
+		Connection::Block body; //shared by all recipients with the same baseline
+		uint8_t player_index = NoPlayerIndex;
+		uint32_t last_input = 0; //recipient's latest applied input
+		bool important = false; //send reliably (see make_state_block)
+	};
+	//record a snapshot and serialize it for each recipient, relative to the snapshot that player last acknowledged:
+	// (each distinct baseline is serialized only once; *messages ends up parallel to recipients)
+	void make_state_messages(std::vector< PlayerTable::Handle > const &recipients, std::vector< StateMessage > *messages);
+	static void send_state_message(Connection *connection, StateMessage const &message);
+	//make_state_messages + send_state_message for every connection:
+	// (unimportant changes go over the unreliable channel)
+	void send_state_messages(std::unordered_map< Connection *, PlayerTable::Handle > const &connection_to_player);
+
+	//snapshot bookkeeping:
+	//(server) recent snapshots sent, oldest first; (client) recent snapshots received, oldest first
+	std::deque< Snapshot > snapshots;
+	//number of snapshots kept around to be used as baselines (about a second at Tick rate):
+	inline static constexpr size_t SnapshotHistory = 32;
+	uint32_t next_snapshot_seq = 1; //(server) sequence number of next recorded snapshot
+	Snapshot const *find_snapshot(uint32_t seq) const;
+	//storage for the next snapshot, recycled from the oldest one so that keeping snapshots doesn't allocate every tick:
+	Snapshot spare_snapshot;
+	//move spare_snapshot to the end of snapshots, making the one that falls out of the history the new spare:
+	void push_spare_snapshot();
+	//(scratch space for make_state_messages: serialized bodies by baseline seq)
+	std::vector< std::pair< uint32_t, StateMessage > > state_bodies;
+
+	//change mask bits for each player in a snapshot body (sent as ChangeMaskBits bits):
+	inline static constexpr uint32_t ChangeMaskBits = 5;
+	enum : uint8_t {
+		ChangedPosition = 1, //(x,y)
+		ChangedStartPosition = 2,
+		ChangedState = 4,
+		ChangedRole = 8,
+		ChangedHeight = 16, //(position's z)
+		ChangedAll = 31,
+	};
 };
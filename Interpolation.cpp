@@ -0,0 +1,152 @@
+#include "Interpolation.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+Interpolation::Interpolation() : Interpolation(Config()) {
+}
+
+Interpolation::Interpolation(Config const &config_) : config(config_) {
+	delay = (config.delay >= 0.0f ? config.delay : std::clamp(Game::Tick, config.min_delay, config.max_delay));
+}
+
+glm::vec3 const *Interpolation::Frame::find(uint8_t want) const {
+	for (uint32_t i = 0; i < id.size(); ++i) {
+		if (id[i] == want) return &position[i];
+	}
+	return nullptr;
+}
+
+void Interpolation::push(Snapshot const &snapshot) {
+	if (count > 0 && snapshot.seq <= frame(count - 1).seq) return;
+	double time = double(snapshot.seq) * double(Game::Tick);
+
+	//timing: how late (relative to the server's clock) did this snapshot arrive?
+	double lateness = local_time - time;
+	if (count == 0 || lateness < offset) offset = lateness;
+	else offset += (lateness - offset) * OffsetDrift;
+	jitter += (float(lateness - offset) - jitter) * JitterGain;
+
+	//add to the ring, dropping the oldest frame if full:
+	// (frames' arrays are reused, so this doesn't allocate once the ring has filled)
+	if (count == Capacity) {
+		first = (first + 1) % Capacity;
+		count -= 1;
+	}
+	Frame &added = frames[(first + count) % Capacity];
+	count += 1;
+	added.time = time;
+	added.seq = snapshot.seq;
+	added.id = snapshot.players.id;
+	added.position = snapshot.players.position;
+}
+
+void Interpolation::advance(float elapsed) {
+	local_time += elapsed;
+
+	if (config.delay >= 0.0f) {
+		delay = config.delay;
+	} else {
+		//enough delay for the next snapshot to (usually) have arrived by the time it's needed:
+		float target = std::clamp(Game::Tick + config.jitter_scale * jitter, config.min_delay, config.max_delay);
+		delay += (target - delay) * std::min(1.0f, elapsed / config.adapt_time);
+	}
+
+	if (count > 0) render_time = std::max(render_time, local_time - offset - double(delay));
+}
+
+//is the move from 'a' to 'b' too fast to be walking?
+static bool is_jump(Interpolation::Config const &config, double time_a, glm::vec3 const &a, double time_b, glm::vec3 const &b) {
+	float reach = config.max_speed * float(time_b - time_a);
+	glm::vec3 between = b - a;
+	return glm::dot(between, between) > reach * reach;
+}
+
+bool Interpolation::sample(uint8_t id, glm::vec3 *position_) const {
+	assert(position_);
+	auto &position = *position_;
+
+	if (count == 0) return false;
+	double t = render_time;
+
+	//first kept snapshot after the render time:
+	uint32_t after = 0;
+	while (after < count && frame(after).time <= t) ++after;
+
+	if (after == 0) {
+		//render time is before every kept snapshot (just started, or snapshots stopped for a while):
+		for (uint32_t i = 0; i < count; ++i) {
+			if (glm::vec3 const *p = frame(i).find(id)) {
+				position = *p;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	if (after == count) {
+		//render time is past the newest snapshot: continue at its velocity for a little while, then stop:
+		Frame const &newest = frame(count - 1);
+		glm::vec3 const *p1 = newest.find(id);
+		if (!p1) return false;
+		position = *p1;
+		if (count >= 2) {
+			Frame const &previous = frame(count - 2);
+			glm::vec3 const *p0 = previous.find(id);
+			if (p0 && !is_jump(config, previous.time, *p0, newest.time, *p1)) {
+				float ahead = float(std::min(t - newest.time, double(config.max_extrapolation)));
+				position += (*p1 - *p0) * (ahead / float(newest.time - previous.time));
+			}
+		}
+		return true;
+	}
+
+	//blend between the snapshots on either side of the render time:
+	Frame const &a = frame(after - 1);
+	Frame const &b = frame(after);
+	glm::vec3 const *pa = a.find(id);
+	glm::vec3 const *pb = b.find(id);
+	if (!pa && !pb) return false;
+	if (!pa || !pb) {
+		//(player is joining or leaving)
+		position = (pa ? *pa : *pb);
+		return true;
+	}
+	if (is_jump(config, a.time, *pa, b.time, *pb)) {
+		position = *pa;
+		return true;
+	}
+
+	float span = float(b.time - a.time);
+	float u = float(t - a.time) / span;
+	if (config.blend == Config::Blend::Linear) {
+		position = glm::mix(*pa, *pb, u);
+		return true;
+	}
+
+	//cubic Hermite: tangents (per unit of u) from the snapshots before 'a' and after 'b' when available (Catmull-Rom style),
+	// otherwise from the segment itself:
+	glm::vec3 ta = *pb - *pa;
+	glm::vec3 tb = *pb - *pa;
+	if (after >= 2) {
+		Frame const &before_a = frame(after - 2);
+		glm::vec3 const *p = before_a.find(id);
+		if (p && !is_jump(config, before_a.time, *p, a.time, *pa)) {
+			ta = (*pb - *p) * (span / float(b.time - before_a.time));
+		}
+	}
+	if (after + 1 < count) {
+		Frame const &after_b = frame(after + 1);
+		glm::vec3 const *p = after_b.find(id);
+		if (p && !is_jump(config, b.time, *pb, after_b.time, *p)) {
+			tb = (*p - *pa) * (span / float(after_b.time - a.time));
+		}
+	}
+	float u2 = u * u;
+	float u3 = u2 * u;
+	position = (2.0f * u3 - 3.0f * u2 + 1.0f) * *pa
+	         + (u3 - 2.0f * u2 + u) * ta
+	         + (-2.0f * u3 + 3.0f * u2) * *pb
+	         + (u3 - u2) * tb;
+	return true;
+}
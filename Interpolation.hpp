@@ -0,0 +1,80 @@
+#pragma once
+
+/*
+ * Interpolation smooths other players' movement on the client.
+ *
+ * Snapshots arrive about once per Game::Tick, but not evenly; drawing the latest one as soon as
+ * it arrives makes remote players move in jumps that wobble with network timing.
+ * Instead, recent snapshots are kept with the server time they were taken at (seq * Game::Tick),
+ * and remote players are drawn a little in the past -- at the "render time" -- blended between
+ * the snapshots on either side of it, so drawing can run at any frame rate.
+ *
+ * The delay behind the newest snapshot adapts to how unevenly snapshots arrive (measured jitter):
+ * just enough that the next snapshot is usually there before it is needed.
+ * If it isn't, positions are extrapolated a little way past the newest snapshot, then held.
+ */
+
+#include "Game.hpp"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+struct Interpolation {
+	struct Config {
+		enum class Blend : uint8_t {
+			Linear,
+			Hermite, //cubic, with tangents from the neighbouring snapshots (smooth through turns)
+		} blend = Blend::Hermite;
+		//fixed delay in seconds, or negative to adapt the delay to measured jitter:
+		float delay = -1.0f;
+		//adaptive delay is one tick plus jitter_scale times the measured jitter, within [min_delay, max_delay]:
+		float jitter_scale = 3.0f;
+		float min_delay = Game::Tick;
+		float max_delay = 0.25f;
+		//(seconds for the delay to move most of the way to a new target; slow, so render time just runs a bit fast or slow)
+		float adapt_time = 1.0f;
+		//how far past the newest snapshot positions may be extrapolated:
+		float max_extrapolation = 0.1f;
+		//moves faster than this are jumps (e.g., being placed at a start position), and aren't blended:
+		float max_speed = 2.0f * Game::PlayerSpeed;
+	};
+	Interpolation(); //default config
+	explicit Interpolation(Config const &config);
+	Config config;
+
+	//record a received snapshot, arriving now; snapshots not newer than the newest one kept are ignored:
+	void push(Snapshot const &snapshot);
+	//advance the local clock and render time by a frame:
+	void advance(float elapsed);
+	//position of player 'id' at the render time (returns false if no kept snapshot has that player):
+	bool sample(uint8_t id, glm::vec3 *position) const;
+
+	//timing (all in seconds):
+	double local_time = 0.0; //advanced by advance()
+	double offset = 0.0; //local arrival time minus server time, for the least-delayed snapshots seen recently
+	float jitter = 0.0f; //smoothed lateness of snapshots relative to 'offset'
+	float delay = 0.0f; //how far behind the newest snapshots the render time runs
+	double render_time = 0.0; //server time being drawn (never goes backward)
+	//(offset follows increases in lateness -- e.g., a change of route -- at this rate per snapshot; decreases immediately)
+	inline static constexpr double OffsetDrift = 0.002;
+	//(jitter is smoothed like RFC 3550's interarrival jitter)
+	inline static constexpr float JitterGain = 1.0f / 16.0f;
+
+	//recent snapshots (just ids and positions), as a ring, oldest first:
+	struct Frame {
+		double time = 0.0; //server time
+		uint32_t seq = 0;
+		std::vector< uint8_t > id;
+		std::vector< glm::vec3 > position;
+		//(only a few players per game, so a linear search is fine)
+		glm::vec3 const *find(uint8_t id) const;
+	};
+	inline static constexpr uint32_t Capacity = 32; //(about a second at Tick rate)
+	std::array< Frame, Capacity > frames;
+	uint32_t first = 0;
+	uint32_t count = 0;
+	Frame const &frame(uint32_t i) const { return frames[(first + i) % Capacity]; }
+};
@@ -1,20 +1,104 @@
 #include "Load.hpp"
 
-#include <array>
-#include <list>
+#include <algorithm>
 #include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace {
-	std::array< std::list< std::function< void() > >, MaxLoadTag > &get_load_lists() {
-		static std::array< std::list< std::function< void() > >, MaxLoadTag > load_lists;
-		return load_lists;
+	struct LoadFunction {
+		LoadTag tag = LoadTagDefault;
+		void const *key = nullptr; //(nullptr if nothing can name it in 'after')
+		std::vector< void const * > after;
+		std::function< void() > on_main; //either a main-thread function...
+		std::function< std::function< void() >() > on_worker; //...or work for a loading thread
+	};
+	std::vector< LoadFunction > &get_load_functions() {
+		static std::vector< LoadFunction > load_functions;
+		return load_functions;
 	}
+
+	//threads that run loading work, handing results back to the main thread:
+	struct LoadWorkers {
+		struct Done {
+			uint32_t index;
+			std::function< void() > finish; //(to run on the main thread)
+			std::exception_ptr error;
+		};
+
+		std::mutex mutex;
+		std::condition_variable work_ready; //signalled when 'work' gets an entry (or on 'quit')
+		std::condition_variable done_ready; //signalled when 'done' gets an entry
+		std::deque< uint32_t > work; //indices of loading functions to run
+		std::deque< Done > done;
+		bool quit = false;
+		std::vector< std::thread > threads;
+
+		explicit LoadWorkers(std::vector< LoadFunction > const &fns, uint32_t count) {
+			for (uint32_t t = 0; t < count; ++t) {
+				threads.emplace_back([this, &fns](){
+					std::unique_lock< std::mutex > lock(mutex);
+					while (true) {
+						work_ready.wait(lock, [this](){ return quit || !work.empty(); });
+						if (quit) return;
+						uint32_t index = work.front();
+						work.pop_front();
+
+						lock.unlock();
+						Done result;
+						result.index = index;
+						try {
+							result.finish = fns[index].on_worker();
+						} catch (...) {
+							result.error = std::current_exception();
+						}
+						lock.lock();
+
+						done.emplace_back(std::move(result));
+						done_ready.notify_one();
+					}
+				});
+			}
+		}
+		~LoadWorkers() {
+			{
+				std::unique_lock< std::mutex > lock(mutex);
+				quit = true;
+			}
+			work_ready.notify_all();
+			for (auto &thread : threads) {
+				thread.join();
+			}
+		}
+	};
 }
 
 void add_load_function(LoadTag tag, std::function< void() > const &fn) {
-	auto &load_lists = get_load_lists();
-	assert(tag < load_lists.size());
-	load_lists[tag].emplace_back(fn);
+	add_load_function(tag, nullptr, {}, fn);
+}
+
+void add_load_function(LoadTag tag, void const *key, std::vector< void const * > const &after, std::function< void() > const &fn) {
+	assert(tag < MaxLoadTag);
+	LoadFunction added;
+	added.tag = tag;
+	added.key = key;
+	added.after = after;
+	added.on_main = fn;
+	get_load_functions().emplace_back(std::move(added));
+}
+
+void add_load_work(LoadTag tag, void const *key, std::vector< void const * > const &after, std::function< std::function< void() >() > const &work) {
+	assert(tag < MaxLoadTag);
+	LoadFunction added;
+	added.tag = tag;
+	added.key = key;
+	added.after = after;
+	added.on_worker = work;
+	get_load_functions().emplace_back(std::move(added));
 }
 
 void call_load_functions() {
@@ -22,11 +106,112 @@ void call_load_functions() {
 	assert(!has_been_called && "call_load_functions should only be called *once*");
 	has_been_called = true;
 
-	auto &load_lists = get_load_lists();
-	for (auto &fn_list : load_lists) {
-		while (!fn_list.empty()) {
-			(*fn_list.begin())(); //call first function in the list
-			fn_list.pop_front(); //remove from list
+	auto &fns = get_load_functions();
+	uint32_t count = uint32_t(fns.size());
+
+	//resolve 'after' lists into prerequisite counts and dependents:
+	// (keys are resolved here, rather than as functions are added, since Load<>s in different files may be constructed in any order)
+	std::unordered_map< void const *, uint32_t > by_key;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (fns[i].key) by_key.emplace(fns[i].key, i);
+	}
+	std::vector< uint32_t > waiting_on(count, 0); //unfinished prerequisites of each function
+	std::vector< std::vector< uint32_t > > dependents(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		for (void const *key : fns[i].after) {
+			auto f = by_key.find(key);
+			if (f == by_key.end()) {
+				throw std::runtime_error("Loading function is after something that isn't being loaded.");
+			}
+			if (fns[f->second].tag > fns[i].tag) {
+				throw std::runtime_error("Loading function is after something with a later load tag.");
+			}
+			//(prerequisites in earlier tags will already be done)
+			if (fns[f->second].tag == fns[i].tag) {
+				dependents[f->second].emplace_back(i);
+				waiting_on[i] += 1;
+			}
 		}
 	}
+
+	//one loading thread per core (the main thread mostly waits, or does OpenGL work):
+	bool any_work = std::any_of(fns.begin(), fns.end(), [](LoadFunction const &fn){ return bool(fn.on_worker); });
+	uint32_t thread_count = (any_work ? std::max(1u, std::thread::hardware_concurrency()) : 0);
+	LoadWorkers workers(fns, thread_count);
+
+	//run each tag's functions, as their prerequisites finish:
+	std::exception_ptr error;
+	for (uint32_t tag = 0; tag < MaxLoadTag && !error; ++tag) {
+		std::deque< uint32_t > ready;
+		uint32_t remaining = 0;
+		for (uint32_t i = 0; i < count; ++i) {
+			if (fns[i].tag != tag) continue;
+			remaining += 1;
+			if (waiting_on[i] == 0) ready.emplace_back(i);
+		}
+
+		auto finished = [&](uint32_t index) {
+			remaining -= 1;
+			for (uint32_t d : dependents[index]) {
+				waiting_on[d] -= 1;
+				if (waiting_on[d] == 0) ready.emplace_back(d);
+			}
+		};
+
+		uint32_t running = 0; //(on loading threads)
+		while (remaining > 0) {
+			//hand work to loading threads, and run main-thread functions:
+			while (!ready.empty() && !error) {
+				uint32_t index = ready.front();
+				ready.pop_front();
+				if (fns[index].on_worker) {
+					std::unique_lock< std::mutex > lock(workers.mutex);
+					workers.work.emplace_back(index);
+					workers.work_ready.notify_one();
+					running += 1;
+				} else {
+					try {
+						fns[index].on_main();
+					} catch (...) {
+						error = std::current_exception();
+						break;
+					}
+					finished(index);
+				}
+			}
+			if (remaining == 0 || (error && running == 0)) break;
+			if (running == 0) {
+				//nothing ready or running, but functions remain:
+				throw std::runtime_error("Loading functions' 'after' lists form a cycle.");
+			}
+
+			//wait for work to finish, then finish it on the main thread:
+			LoadWorkers::Done done;
+			{
+				std::unique_lock< std::mutex > lock(workers.mutex);
+				workers.done_ready.wait(lock, [&](){ return !workers.done.empty(); });
+				done = std::move(workers.done.front());
+				workers.done.pop_front();
+			}
+			running -= 1;
+			if (done.error) {
+				if (!error) error = done.error;
+				continue;
+			}
+			if (error) continue; //(once something has failed, just wait for running work to stop)
+			try {
+				if (done.finish) done.finish();
+			} catch (...) {
+				error = std::current_exception();
+				continue;
+			}
+			finished(done.index);
+		}
+	}
+
+	if (error) std::rethrow_exception(error);
+
+	//(loading functions often hold captured data; free it)
+	fns.clear();
+	fns.shrink_to_fit();
 }
@@ -20,10 +20,25 @@
  * These functions are grouped by 'tags', which allow some sequencing of calls.
  * (particularly, this is useful for loading large data blobs [e.g. Meshes] before looking up individual elements within them.)
  *
+ * Within a tag, a Load<> can also list other Load<>s it needs (which must be in the same or an earlier tag),
+ * and the work of loading can be moved off the main thread:
+ *
+ * Load< WalkMeshes > walkmeshes(LoadTagDefault, {}, []() {
+ *     //runs on a loading thread (so must not use OpenGL):
+ *     auto ret = std::make_shared< WalkMeshes >(data_path("level.w"));
+ *     //returned function runs on the main thread once the work is done:
+ *     return [ret]() -> WalkMeshes const * { return new WalkMeshes(std::move(*ret)); };
+ * });
+ *
+ * Load< Scene > scene(LoadTagDefault, { &meshes }, ...); //<-- won't start until 'meshes' has finished loading
+ *
+ * call_load_functions() runs loading work for all ready Load<>s in parallel on a pool of threads,
+ * while the main thread runs main-thread functions (e.g., shader compiles and OpenGL uploads) as they become ready.
  */
 
 #include <functional>
 #include <stdexcept>
+#include <vector>
 
 enum LoadTag : uint32_t {
 	LoadTagEarly,
@@ -36,9 +51,18 @@ enum LoadTag : uint32_t {
 // (only call *before* "call_load_functions()")
 void add_load_function(LoadTag tag, std::function< void() > const &fn);
 
+//...with a key (so other loading functions can name it in their 'after' lists -- Load<>s use their own address),
+// run only once the loading functions with keys in 'after' have finished:
+void add_load_function(LoadTag tag, void const *key, std::vector< void const * > const &after, std::function< void() > const &fn);
+
+//Add loading work that can run on a loading thread (so must not use OpenGL or touch unsynchronized shared state):
+// 'work' returns a function (or nullptr) that is then run on the main thread, e.g. to upload to OpenGL
+// (the work counts as finished -- for others' 'after' lists -- once that function has run)
+void add_load_work(LoadTag tag, void const *key, std::vector< void const * > const &after, std::function< std::function< void() >() > const &work);
+
 //Call all loading functions:
-// (loading functions may throw exceptions if they fail.)
-// (only call *once*)
+// (loading functions may throw exceptions if they fail; the first exception is rethrown once running work has stopped.)
+// (only call *once*, from the thread with the OpenGL context)
 void call_load_functions();
 
 
@@ -49,15 +73,33 @@ T const *new_T() { return new T; }
 template< typename T >
 struct Load {
 	//Constructing a Load< T > adds the passed function to the list of functions to call:
-	Load(LoadTag tag, const std::function< T const *() > &load_fn = new_T< T >) : value(nullptr) {
-		add_load_function(tag, [this,load_fn](){
-			this->value = load_fn();
-			if (!(this->value)) {
-				throw std::runtime_error("Loading failed.");
-			}
+	Load(LoadTag tag, const std::function< T const *() > &load_fn = new_T< T >) : Load(tag, {}, load_fn) { }
+
+	//...after the Load<>s in 'after' (e.g., { &some_meshes }) have finished:
+	Load(LoadTag tag, std::vector< void const * > const &after, const std::function< T const *() > &load_fn) : value(nullptr) {
+		add_load_function(tag, this, after, [this,load_fn](){
+			this->set(load_fn());
 		});
 	}
 
+	//...or with the loading work on a loading thread:
+	// 'work' returns a function that runs on the main thread (so can, e.g., upload to OpenGL) and returns the loaded value
+	Load(LoadTag tag, std::vector< void const * > const &after, const std::function< std::function< T const *() >() > &work) : value(nullptr) {
+		add_load_work(tag, this, after, [this,work]() -> std::function< void() > {
+			std::function< T const *() > finish = work();
+			return [this,finish](){
+				this->set(finish());
+			};
+		});
+	}
+
+	void set(T const *value_) {
+		value = value_;
+		if (!value) {
+			throw std::runtime_error("Loading failed.");
+		}
+	}
+
 	//Make a "Load< T >" behave like a "T const *":
 	explicit operator bool() { return value != nullptr; }
 	operator T const *() { return value; }
@@ -74,7 +116,10 @@ template< >
 struct Load< void > {
 	//Constructing a Load< T > adds the passed function to the list of functions to call:
 	Load( LoadTag tag, const std::function< void() > &load_fn) {
-		add_load_function(tag, load_fn);
+		add_load_function(tag, this, {}, load_fn);
+	}
+	Load( LoadTag tag, std::vector< void const * > const &after, const std::function< void() > &load_fn) {
+		add_load_function(tag, this, after, load_fn);
 	}
 };
 
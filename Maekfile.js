@@ -135,10 +135,24 @@ if (maek.OS === 'windows') {
 // cppFile: name of c++ file to compile
 // objFileBase (optional): base name object file to produce (if not supplied, set to options.objDir + '/' + cppFile without the extension)
 //returns objFile: objFileBase + a platform-dependant suffix ('.o' or '.obj')
+const walkmesh_names = [
+	maek.CPP('WalkMesh.cpp')
+];
+
+const count_neighbours_names = [
+	maek.CPP('count_neighbours.cpp')
+];
+
+const asset_names = [
+	maek.CPP('data_path.cpp'),
+	maek.CPP('MappedFile.cpp'),
+	maek.CPP('AssetPack.cpp')
+];
+
 const client_names = [
-	maek.CPP('WalkMesh.cpp'),
 	maek.CPP('client.cpp'),
 	maek.CPP('PlayMode.cpp'),
+	maek.CPP('Interpolation.cpp'),
 	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
 	maek.CPP('Sound.cpp'),
@@ -147,12 +161,16 @@ const client_names = [
 ];
 
 const server_names = [
-	maek.CPP('server.cpp')
+	maek.CPP('server.cpp'),
+	maek.CPP('Profile.cpp')
 ];
 
 const common_names = [
 	maek.CPP('Game.cpp'),
-	maek.CPP('data_path.cpp'),
+	maek.CPP('Board.cpp'),
+	...count_neighbours_names,
+	...walkmesh_names,
+	...asset_names,
 	maek.CPP('PathFont.cpp'),
 	maek.CPP('PathFont-font.cpp'),
 	maek.CPP('DrawLines.cpp'),
@@ -168,12 +186,24 @@ const common_names = [
 	maek.CPP('hex_dump.cpp')
 ];
 
+const bot_client_names = [
+	maek.CPP('bot-client.cpp')
+];
+
+const benchmark_neighbours_names = [
+	maek.CPP('benchmark-neighbours.cpp')
+];
+
 const show_meshes_names = [
 	maek.CPP('show-meshes.cpp'),
 	maek.CPP('ShowMeshesProgram.cpp'),
 	maek.CPP('ShowMeshesMode.cpp')
 ];
 
+const pack_assets_names = [
+	maek.CPP('pack-assets.cpp')
+];
+
 const show_scene_names = [
 	maek.CPP('show-scene.cpp'),
 	maek.CPP('ShowSceneProgram.cpp'),
@@ -186,11 +216,14 @@ const show_scene_names = [
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
 const client_exe = maek.LINK([...client_names, ...common_names], 'dist/client');
 const server_exe = maek.LINK([...server_names, ...common_names], 'dist/server');
+const bot_client_exe = maek.LINK([...bot_client_names, ...common_names], 'dist/bot-client');
+const benchmark_neighbours_exe = maek.LINK([...benchmark_neighbours_names, ...count_neighbours_names], 'dist/benchmark-neighbours');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
+const pack_assets_exe = maek.LINK([...pack_assets_names, ...asset_names], 'scenes/pack-assets');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [client_exe, server_exe, show_meshes_exe, show_scene_exe, ...copies];
+maek.TARGETS = [client_exe, server_exe, bot_client_exe, benchmark_neighbours_exe, show_meshes_exe, show_scene_exe, pack_assets_exe, ...copies];
 
 //the '[targets =] RULE(targets, prerequisites[, recipe])' rule defines a Makefile-style task
 // targets: array of targets the task produces (can include both files and ':abstract targets')
@@ -201,6 +234,14 @@ maek.RULE([':run'], [client_exe], [
 	[client_exe, '--some-command-line-option']
 ]);
 
+//pack the game's assets into dist/assets.pack (which the game then loads in place of the loose files):
+// (re-packed whenever one of the packed files changes; the game also ignores a pack older than any of its files)
+const packed_assets = ['dist/plane.pnct', 'dist/plane.scene', 'dist/plane.w'];
+maek.RULE(['dist/assets.pack'], [pack_assets_exe, ...packed_assets], [
+	[pack_assets_exe, 'dist/assets.pack', ...packed_assets]
+]);
+maek.RULE([':pack'], ['dist/assets.pack']);
+
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
 
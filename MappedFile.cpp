@@ -0,0 +1,57 @@
+#include "MappedFile.hpp"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(std::string const &filename_) : filename(filename_) {
+	#ifdef _WIN32
+	std::ifstream file(filename, std::ios::binary | std::ios::ate);
+	if (!file) throw std::runtime_error("Failed to open '" + filename + "'.");
+	contents.resize(size_t(file.tellg()));
+	file.seekg(0);
+	if (!contents.empty() && !file.read(reinterpret_cast< char * >(contents.data()), std::streamsize(contents.size()))) {
+		throw std::runtime_error("Failed to read '" + filename + "'.");
+	}
+	data = (contents.empty() ? nullptr : contents.data());
+	size = contents.size();
+	#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) throw std::runtime_error("Failed to open '" + filename + "': " + std::strerror(errno));
+
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		int error = errno;
+		close(fd);
+		throw std::runtime_error("Failed to stat '" + filename + "': " + std::strerror(error));
+	}
+	size = size_t(info.st_size);
+
+	if (size > 0) {
+		void *mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapped == MAP_FAILED) {
+			int error = errno;
+			close(fd);
+			throw std::runtime_error("Failed to map '" + filename + "': " + std::strerror(error));
+		}
+		data = reinterpret_cast< uint8_t const * >(mapped);
+	}
+	//(the mapping holds its own reference to the file)
+	close(fd);
+	#endif
+}
+
+MappedFile::~MappedFile() {
+	#ifndef _WIN32
+	if (data) munmap(const_cast< uint8_t * >(data), size);
+	#endif
+}
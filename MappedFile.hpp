@@ -0,0 +1,33 @@
+#pragma once
+
+/*
+ * MappedFile makes a file's contents readable in memory without copying them into buffers:
+ *  - on POSIX systems the file is mmap'd read-only and shared, so pages come straight from
+ *    the OS page cache (and are shared between processes mapping the same file);
+ *  - elsewhere (Windows) the whole file is read into memory once.
+ *
+ * The contents stay valid (and unchanged) for the MappedFile's lifetime.
+ * See ChunkReader in read_write_chunk.hpp for reading chunked asset files from a mapping.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct MappedFile {
+	//map a file (throws std::runtime_error if it can't be opened or mapped):
+	explicit MappedFile(std::string const &filename);
+	~MappedFile();
+	MappedFile(MappedFile const &) = delete;
+	MappedFile &operator=(MappedFile const &) = delete;
+
+	std::string filename; //(for error messages)
+	uint8_t const *data = nullptr; //(nullptr if the file is empty)
+	size_t size = 0;
+
+	//internals:
+	#ifdef _WIN32
+	std::vector< uint8_t > contents;
+	#endif
+};
@@ -1,20 +1,32 @@
 #include "Mesh.hpp"
+#include "AssetPack.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/glm.hpp>
 
 #include <stdexcept>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <set>
 #include <cstddef>
+#include <cstring>
+#include <cassert>
+
+MeshBuffer::MeshBuffer(std::string const &filename, Upload when) {
+	mapping = std::make_unique< MappedFile >(filename);
+	ChunkReader reader(*mapping);
+	load(reader, when);
+	if (when == Upload::Now) mapping.reset();
+}
 
-MeshBuffer::MeshBuffer(std::string const &filename) {
-	glGenBuffers(1, &buffer);
+MeshBuffer::MeshBuffer(AssetPack const &pack, std::string const &name, Upload when) {
+	ChunkReader reader = pack.reader(name);
+	load(reader, when);
+}
 
-	std::ifstream file(filename, std::ios::binary);
+void MeshBuffer::load(ChunkReader &reader, Upload when) {
+	std::string const &filename = reader.name;
 
 	GLuint total = 0;
 
@@ -25,18 +37,27 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		glm::vec2 TexCoord;
 	};
 	static_assert(sizeof(Vertex) == 3*4+3*4+4*1+2*4, "Vertex is packed.");
-	std::vector< Vertex > data;
+	//(read as bytes, which are never copied by the reader, so they stay in the mapped memory for upload())
+	ChunkSpan< uint8_t > data;
 
 	//read + upload data chunk:
 	if (filename.size() >= 5 && filename.substr(filename.size()-5) == ".pnct") {
-		read_chunk(file, "pnct", &data);
+		data = reader.read< uint8_t >("pnct");
+		if (data.size() % sizeof(Vertex) != 0) {
+			throw std::runtime_error("Size of chunk 'pnct' in '" + filename + "' not divisible by vertex size");
+		}
 
-		//upload data:
-		glBindBuffer(GL_ARRAY_BUFFER, buffer);
-		glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		//upload data (straight from the mapped file), or remember where it is to upload later:
+		if (when == Upload::Now) {
+			glGenBuffers(1, &buffer);
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+		} else {
+			pending = data;
+		}
 
-		total = GLuint(data.size()); //store total for later checks on index
+		total = GLuint(data.size() / sizeof(Vertex)); //store total for later checks on index
 
 		//store attrib locations:
 		Position = Attrib(3, GL_FLOAT, GL_FALSE, sizeof(Vertex), offsetof(Vertex, Position));
@@ -47,8 +68,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		throw std::runtime_error("Unknown file type '" + filename + "'");
 	}
 
-	std::vector< char > strings;
-	read_chunk(file, "str0", &strings);
+	ChunkSpan< char > strings = reader.read< char >("str0");
 
 	{ //read index chunk, add to meshes:
 		struct IndexEntry {
@@ -57,8 +77,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		};
 		static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
 
-		std::vector< IndexEntry > index;
-		read_chunk(file, "idx0", &index);
+		ChunkSpan< IndexEntry > index = reader.read< IndexEntry >("idx0");
 
 		for (auto const &entry : index) {
 			if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
@@ -67,14 +86,17 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 			if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
 				throw std::runtime_error("index entry has out-of-range vertex start/count");
 			}
-			std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+			std::string name(strings.begin() + entry.name_begin, strings.begin() + entry.name_end);
 			Mesh mesh;
 			mesh.type = GL_TRIANGLES;
 			mesh.start = entry.vertex_begin;
 			mesh.count = entry.vertex_end - entry.vertex_begin;
 			for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
-				mesh.min = glm::min(mesh.min, data[v].Position);
-				mesh.max = glm::max(mesh.max, data[v].Position);
+				//(vertices may not be aligned in the file, so positions are copied out)
+				glm::vec3 position;
+				std::memcpy(&position, data.data() + v * sizeof(Vertex) + offsetof(Vertex, Position), sizeof(position));
+				mesh.min = glm::min(mesh.min, position);
+				mesh.max = glm::max(mesh.max, position);
 			}
 			bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
 			if (!inserted) {
@@ -83,7 +105,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 		}
 	}
 
-	if (file.peek() != EOF) {
+	if (!reader.at_end()) {
 		std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
 	}
 
@@ -98,6 +120,16 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
 	*/
 }
 
+void MeshBuffer::upload() {
+	assert(buffer == 0 && "MeshBuffer should only be uploaded once");
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, pending.size(), pending.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	pending = ChunkSpan< uint8_t >();
+	mapping.reset();
+}
+
 const Mesh &MeshBuffer::lookup(std::string const &name) const {
 	auto f = meshes.find(name);
 	if (f == meshes.end()) {
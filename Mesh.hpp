@@ -10,11 +10,16 @@
  */
 
 #include "GL.hpp"
+#include "read_write_chunk.hpp"
 #include <glm/glm.hpp>
 #include <map>
 #include <limits>
+#include <memory>
 #include <string>
+#include <vector>
 
+//(see AssetPack.hpp)
+struct AssetPack;
 
 struct Mesh {
 	//Meshes are vertex ranges (and primitive types) in their MeshBuffer:
@@ -32,7 +37,16 @@ struct Mesh {
 struct MeshBuffer {
 	//construct from a file:
 	// note: will throw if file fails to read.
-	MeshBuffer(std::string const &filename);
+	// with Upload::Later, no OpenGL calls are made (so this can run on a loading thread) until upload() is called
+	enum class Upload { Now, Later };
+	MeshBuffer(std::string const &filename, Upload when = Upload::Now);
+	//...or from a file in an asset pack:
+	// (with Upload::Later, vertex data is uploaded straight from the pack, so the pack must stay open until upload())
+	MeshBuffer(AssetPack const &pack, std::string const &name, Upload when = Upload::Now);
+	//(both read the file's chunks here)
+	void load(ChunkReader &reader, Upload when);
+	//upload vertex data read with Upload::Later:
+	void upload();
 
 	//look up a particular mesh by name:
 	// note: will throw if mesh not found.
@@ -44,6 +58,9 @@ struct MeshBuffer {
 
 	//This is the OpenGL vertex buffer object containing the mesh data:
 	GLuint buffer = 0;
+	//(when loaded with Upload::Later: vertex data waiting for upload(), in place in the mapped file or asset pack)
+	ChunkSpan< uint8_t > pending;
+	std::unique_ptr< MappedFile > mapping; //(keeps a loose file mapped until upload())
 
 	//-- internals ---
 
@@ -7,6 +7,7 @@
 #include "Load.hpp"
 #include "gl_errors.hpp"
 #include "data_path.hpp"
+#include "AssetPack.hpp"
 #include "hex_dump.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
@@ -19,15 +20,21 @@
 #include <thread>
 
 
+//(assets are read on loading threads; only OpenGL work happens on the main thread -- see Load.hpp)
+
 GLuint phonebank_meshes_for_lit_color_texture_program = 0;
-Load< MeshBuffer > phonebank_meshes(LoadTagDefault, []() -> MeshBuffer const * {
-	MeshBuffer const *ret = new MeshBuffer(data_path("plane.pnct"));
-	phonebank_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
-	return ret;
+Load< MeshBuffer > phonebank_meshes(LoadTagDefault, {}, []() {
+	MeshBuffer::Upload later = MeshBuffer::Upload::Later;
+	MeshBuffer *ret = (game_assets() ? new MeshBuffer(*game_assets(), "plane.pnct", later) : new MeshBuffer(data_path("plane.pnct"), later));
+	return [ret]() -> MeshBuffer const * {
+		ret->upload();
+		phonebank_meshes_for_lit_color_texture_program = ret->make_vao_for_program(lit_color_texture_program->program);
+		return ret;
+	};
 });
 
-Load< Scene > phonebank_scene(LoadTagDefault, []() -> Scene const * {
-	return new Scene(data_path("plane.scene"), [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
+Load< Scene > phonebank_scene(LoadTagDefault, { &phonebank_meshes }, []() {
+	auto on_drawable = [&](Scene &scene, Scene::Transform *transform, std::string const &mesh_name){
 		Mesh const &mesh = phonebank_meshes->lookup(mesh_name);
 
 		scene.drawables.emplace_back(transform);
@@ -40,17 +47,21 @@ Load< Scene > phonebank_scene(LoadTagDefault, []() -> Scene const * {
 		drawable.pipeline.start = mesh.start;
 		drawable.pipeline.count = mesh.count;
 
-	});
+	};
+	Scene *ret = (game_assets() ? new Scene(*game_assets(), "plane.scene", on_drawable) : new Scene(data_path("plane.scene"), on_drawable));
+	return [ret]() -> Scene const * { return ret; };
 });
 
 WalkMesh const *walkmesh = nullptr;
-Load< WalkMeshes > phonebank_walkmeshes(LoadTagDefault, []() -> WalkMeshes const * {
-	WalkMeshes *ret = new WalkMeshes(data_path("plane.w"));
-	walkmesh = &ret->lookup("WalkMesh.001");
-	return ret;
+Load< WalkMeshes > phonebank_walkmeshes(LoadTagDefault, {}, []() {
+	WalkMeshes *ret = (game_assets() ? new WalkMeshes(*game_assets(), "plane.w") : new WalkMeshes(data_path("plane.w")));
+	return [ret]() -> WalkMeshes const * {
+		walkmesh = &ret->lookup("WalkMesh.001");
+		return ret;
+	};
 });
 
-PlayMode::PlayMode(Client &client_) : scene(*phonebank_scene), client(client_) {
+PlayMode::PlayMode(Client &client_, Interpolation::Config const &interpolation_config) : scene(*phonebank_scene), interpolation(interpolation_config), client(client_) {
 	for (auto &trans : scene.transforms) {
 		if (trans.name == "Cone") target = &trans;
 	}
@@ -155,6 +166,8 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 }
 
 void PlayMode::update(float elapsed) {
+	interpolation.advance(elapsed);
+
 	if (countdown > 0.0f) {
 		countdown -= elapsed;
 		if (countdown <= 0) {
@@ -164,75 +177,40 @@ void PlayMode::update(float elapsed) {
 		return;
 	}
 
-	static bool start_pos_set = false;
-
 	Player::Controls &controls = local_player.controls;
-	//player walking:
-	{
-		//combine inputs into a move:
-		constexpr float PlayerSpeed = 3.0f;
-		glm::vec2 move = glm::vec2(0.0f);
-		if (controls.left.pressed && !controls.right.pressed) move.x =-1.0f;
-		if (!controls.left.pressed && controls.right.pressed) move.x = 1.0f;
-		if (controls.down.pressed && !controls.up.pressed) move.y =-1.0f;
-		if (!controls.down.pressed && controls.up.pressed) move.y = 1.0f;
-
-		//make it so that moving diagonally doesn't go faster:
-		if (move != glm::vec2(0.0f)) move = glm::normalize(move) * PlayerSpeed * elapsed;
-
-		//get move in world coordinate system:
-		glm::vec3 remain = transform->make_local_to_world() * glm::vec4(move.x, move.y, 0.0f, 0.0f);
-
-		//using a for() instead of a while() here so that if walkpoint gets stuck in
-		// some awkward case, code will not infinite loop:
-		for (uint32_t iter = 0; iter < 10; ++iter) {
-			if (remain == glm::vec3(0.0f)) break;
-			WalkPoint end;
-			float time;
-			walkmesh->walk_in_triangle(at, remain, &end, &time);
-			at = end;
-			if (time == 1.0f) {
-				//finished within triangle:
-				remain = glm::vec3(0.0f);
-				break;
+	//player walking (once placed), one input per Game::Tick:
+	if (start_pos_set) {
+		//(after a long frame, skip inputs rather than run far ahead of the server)
+		input_accumulator = std::min(input_accumulator + elapsed, 4.0f * Game::Tick);
+		bool sampled = false;
+		while (input_accumulator >= Game::Tick) {
+			input_accumulator -= Game::Tick;
+
+			//movement is relative to the player's facing in the ground plane:
+			glm::vec3 right = transform->rotation * glm::vec3(1.0f, 0.0f, 0.0f);
+			Player::Input input = local_player.sample_input(next_input_seq++, std::atan2(right.y, right.x));
+			//(the server checks this input's catches against other players as they're being drawn now)
+			if (interpolation.count > 0) input.view = Player::view_of_time(interpolation.render_time);
+
+			//predict the move the server will make:
+			previous_position = walkmesh->to_world_point(at);
+			if (!walkmesh->walk(&at, Player::input_step(input))) {
+				std::cout << "NOTE: code used full iteration budget for walking." << std::endl;
 			}
-			//some step remains:
-			remain *= (1.0f - time);
-			//try to step over edge:
-			glm::quat rotation;
-			if (walkmesh->cross_edge(at, &end, &rotation)) {
-				//stepped to a new triangle:
-				at = end;
-				//rotate step to follow surface:
-				remain = rotation * remain;
-			} else {
-				//ran into a wall, bounce / slide along it:
-				glm::vec3 const &a = walkmesh->vertices[at.indices.x];
-				glm::vec3 const &b = walkmesh->vertices[at.indices.y];
-				glm::vec3 const &c = walkmesh->vertices[at.indices.z];
-				glm::vec3 along = glm::normalize(b-a);
-				glm::vec3 normal = glm::normalize(glm::cross(b-a, c-a));
-				glm::vec3 in = glm::cross(normal, along);
-
-				//check how much 'remain' is pointing out of the triangle:
-				float d = glm::dot(remain, in);
-				if (d < 0.0f) {
-					//bounce off of the wall:
-					remain += (-1.25f * d) * in;
-				} else {
-					//if it's just pointing along the edge, bend slightly away from wall:
-					remain += 0.01f * d * in;
-				}
+			local_player.inputs.emplace_back(input);
+			predicted.emplace_back(walkmesh->to_world_point(at));
+			if (local_player.inputs.size() > MaxUnappliedInputs) {
+				local_player.inputs.erase(local_player.inputs.begin());
+				predicted.erase(predicted.begin());
 			}
+			sampled = true;
 		}
 
-		if (remain != glm::vec3(0.0f)) {
-			std::cout << "NOTE: code used full iteration budget for walking." << std::endl;
-		}
+		//send controls to the server (unreliably: each message repeats the inputs the server hasn't applied yet)
+		if (sampled) local_player.send_controls_message(&client.connection, Connection::Unreliable);
 
-		//update player's position to respect walking:
-		transform->position = walkmesh->to_world_point(at);
-		local_player.position = transform->position;
+		//draw the player between the last two predicted positions, so movement is smooth at any frame rate:
+		transform->position = glm::mix(previous_position, walkmesh->to_world_point(at), input_accumulator / Game::Tick);
 		{ //update player's rotation to respect local (smooth) up-vector:
 			
 			glm::quat adjust = glm::rotation(
@@ -243,9 +221,6 @@ void PlayMode::update(float elapsed) {
 		}
 	}
 
-	// send player location to the server to query the current state
-	local_player.send_player_message(&client.connection);
-
 	//reset button press counters:
 	controls.left.downs = 0;
 	controls.right.downs = 0;
@@ -254,35 +229,47 @@ void PlayMode::update(float elapsed) {
 	controls.jump.downs = 0;
 
 	// receive data:
-	client.poll([this](Connection *c, Connection::Event event){
+	bool got_state = false;
+	client.poll([this,&got_state](Connection *c, Connection::Event event){
 		if (event == Connection::OnOpen) {
 			std::cout << "[" << c->socket << "] opened" << std::endl;
 		} else if (event == Connection::OnClose) {
 			std::cout << "[" << c->socket << "] closed (!)" << std::endl;
 			throw std::runtime_error("Lost connection to server!");
 		} else { assert(event == Connection::OnRecv);
-			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
+			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
 			bool handled_message;
+			uint32_t newest_seq = (game.snapshots.empty() ? 0 : game.snapshots.back().seq);
 			try {
 				do {
 					handled_message = false;
-					if (game.recv_state_message(c)) handled_message = true;
+					if (game.recv_state_message(c)) handled_message = got_state = true;
 				} while (handled_message);
 			} catch (std::exception const &e) {
 				std::cerr << "[" << c->socket << "] malformed message from server: " << e.what() << std::endl;
 				//quit the game:
 				throw e;
 			}
+			//let the server know which snapshot to send the next state relative to:
+			// (only when a newer one arrived; stale or duplicated states are parsed too)
+			if (!game.snapshots.empty() && game.snapshots.back().seq != newest_seq) game.send_ack_message(c, Connection::Unreliable);
 		}
 	}, 0.0);
 
+	if (got_state) {
+		reconcile();
+		//(every snapshot received this frame, oldest first; ones already pushed are skipped)
+		for (Snapshot const &snapshot : game.snapshots) {
+			interpolation.push(snapshot);
+		}
+	}
+
 	if (game.players.size() > 0) {
-		Player &me = game.players.front();
-		if (me.start_position != glm::vec3(0.0f, 0.0f, 0.0f) && !start_pos_set) {
+		glm::vec3 const &start_position = game.players.start_position.front();
+		if (start_position != glm::vec3(0.0f, 0.0f, 0.0f) && !start_pos_set) {
 			// reset player
-			transform->position = me.start_position;
-			local_player.position = transform->position;
-			if (me.start_position.x < 0 && me.start_position.y < 0)
+			transform->position = start_position;
+			if (start_position.x < 0 && start_position.y < 0)
 				transform->rotation = glm::angleAxis(glm::radians(-45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
 			else
 				transform->rotation = glm::angleAxis(glm::radians(180.0f - 45.0f), glm::vec3(0.0f, 0.0f, 1.0f));
@@ -290,8 +277,9 @@ void PlayMode::update(float elapsed) {
 			//rotate camera facing direction (-z) to player facing direction (+y):
 			camera->transform->rotation = glm::angleAxis(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 
-			//start player walking at nearest walk point:
+			//start player walking at nearest walk point (as the server does):
 			at = walkmesh->nearest_walk_point(transform->position);
+			previous_position = walkmesh->to_world_point(at);
 
 			start_pos_set = true;
 		}
@@ -300,9 +288,39 @@ void PlayMode::update(float elapsed) {
 	if (game.players.size() > 1) {
 		// std::cout << "now we have more than one players!" << std::endl;
 		assert(game.players.size() == 2);
-		target->position.x = game.players.back().position.x;
-		target->position.y = game.players.back().position.y;
+		//(drawn a little in the past, smoothly between snapshots)
+		glm::vec3 position;
+		if (interpolation.sample(game.players.id.back(), &position)) {
+			target->position.x = position.x;
+			target->position.y = position.y;
+		}
+	}
+}
+
+void PlayMode::reconcile() {
+	if (game.players.empty() || !start_pos_set) return;
+	auto &inputs = local_player.inputs;
+
+	//forget inputs the server has applied, noting where the last of them was predicted to end up:
+	size_t applied = 0;
+	while (applied < inputs.size() && inputs[applied].seq <= game.last_input) ++applied;
+	if (applied == 0) return; //(nothing new to compare against)
+	glm::vec3 expected = predicted[applied - 1];
+	inputs.erase(inputs.begin(), inputs.begin() + applied);
+	predicted.erase(predicted.begin(), predicted.begin() + applied);
+
+	glm::vec3 const &position = game.players.position.front();
+	glm::vec3 error = position - expected;
+	if (glm::dot(error, error) <= ReconcileTolerance * ReconcileTolerance) return;
+
+	//misprediction: continue from where the server has the player, redoing the moves it hasn't seen yet:
+	at = walkmesh->nearest_walk_point(position);
+	for (size_t i = 0; i < inputs.size(); ++i) {
+		walkmesh->walk(&at, Player::input_step(inputs[i]));
+		predicted[i] = walkmesh->to_world_point(at);
 	}
+	//(blend from where the player is drawn now, rather than jumping)
+	previous_position = transform->position;
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
@@ -317,7 +335,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 	glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
 	glUseProgram(0);
 
-	int16_t current_state = game.players.front().current_state;
+	int16_t current_state = game.players.current_state.front();
 
 	{	// set background color based on current state
 		const std::vector<glm::vec3> color_pallete = {
@@ -405,7 +423,7 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 		color);
 	}
 
-	if (game.players.front().role == Player::Role::HUNTER) {
+	if (game.players.role.front() == Player::Role::HUNTER) {
 		constexpr float H = 0.09f;
 		std::string hunter_text = game.since_begin > 0?
 			"Hunting Time  " + std::to_string(game.since_begin) : "Hunting Time";
@@ -430,19 +448,20 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 
 void PlayMode::reset_game() {
 	std::cout << "reset!" << std::endl;
-	// reset player
-	Player &me = game.players.front();
-	transform->position = me.start_position;
-	local_player.position = transform->position;
+	// reset player (to where the server has them)
+	transform->position = game.players.position.front();
 	transform->rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
 
 	//rotate camera facing direction (-z) to player facing direction (+y):
 	camera->transform->rotation = glm::angleAxis(glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
 
-	//start player walking at nearest walk point:
+	//start player walking at nearest walk point, forgetting any moves the server hasn't confirmed:
 	at = walkmesh->nearest_walk_point(transform->position);
+	previous_position = walkmesh->to_world_point(at);
+	local_player.inputs.clear();
+	predicted.clear();
 
-	game.players.front().current_state = -2;
+	game.players.current_state.front() = -2;
 
 	update(0);
 }
@@ -2,6 +2,7 @@
 
 #include "Connection.hpp"
 #include "Game.hpp"
+#include "Interpolation.hpp"
 
 #include "Scene.hpp"
 #include "WalkMesh.hpp"
@@ -13,7 +14,7 @@
 #include <array>
 
 struct PlayMode : Mode {
-	PlayMode(Client &client);
+	PlayMode(Client &client, Interpolation::Config const &interpolation_config = Interpolation::Config());
 	virtual ~PlayMode();
 
 	//functions called by main loop:
@@ -31,14 +32,32 @@ struct PlayMode : Mode {
 	//camera is at player's head and will be pitched by mouse up/down motion:
 	Scene::Camera *camera = nullptr;
 	float countdown = 0.0f;
+	bool start_pos_set = false; //has the player been placed at the start position the server picked?
 
 	void reset_game();
 
-	Player local_player;
+	//controls are sampled into numbered inputs once per Game::Tick; each input moves the player right away (prediction)
+	// and is sent to the server until a state message says it has been applied:
+	Player local_player; //(local_player.inputs holds the inputs not yet applied by the server)
+	float input_accumulator = 0.0f; //time since the last input was sampled
+	uint32_t next_input_seq = 1;
+	std::vector< glm::vec3 > predicted; //predicted position after each of local_player.inputs
+	glm::vec3 previous_position = glm::vec3(0.0f); //predicted position before the latest input (drawing blends from here)
+	//drop inputs the server has applied, and if its position disagrees with the prediction,
+	// start again from the server's position and replay the inputs it hasn't applied yet:
+	void reconcile();
+	//predictions further than this from the server's position are corrected:
+	// (positions are quantized on the wire, so some error is expected)
+	inline static constexpr float ReconcileTolerance = 0.01f;
+	//if the server stops applying inputs (e.g., once the game is over), stop keeping the old ones around:
+	inline static constexpr size_t MaxUnappliedInputs = 64;
 
 	//latest game state (from server):
 	Game game;
 
+	//recent snapshots, for drawing other players smoothly (see Interpolation.hpp):
+	Interpolation interpolation;
+
 	//last message from server:
 	std::string server_message;
 
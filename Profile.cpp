@@ -0,0 +1,172 @@
+#include "Profile.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iomanip>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Profile {
+
+char const *phase_name(Phase phase) {
+	switch (phase) {
+		case Poll: return "poll";
+		case Send: return "send";
+		case Update: return "update";
+		case Serialize: return "serialize";
+		case Tick: return "tick";
+		case PhaseCount: break;
+	}
+	return "?";
+}
+
+//index of the highest set bit of a (nonzero) value:
+static uint32_t highest_bit(uint64_t value) {
+	assert(value != 0);
+	#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return uint32_t(index);
+	#else
+	return uint32_t(63 - __builtin_clzll(value));
+	#endif
+}
+
+uint32_t Histogram::bucket_of(uint64_t value) {
+	if (value < SubBuckets) return uint32_t(value);
+	if (value >> MaxBits) return BucketCount - 1;
+	//'magnitude' is how far the value is shifted to leave SubBucketBits significant bits:
+	uint32_t magnitude = highest_bit(value) - SubBucketBits + 1;
+	uint32_t sub_bucket = uint32_t(value >> magnitude); //in [SubBuckets/2, SubBuckets)
+	return magnitude * (SubBuckets / 2) + sub_bucket;
+}
+
+uint64_t Histogram::bucket_min(uint32_t bucket) {
+	if (bucket < SubBuckets) return bucket;
+	uint32_t magnitude = bucket / (SubBuckets / 2) - 1;
+	uint64_t sub_bucket = bucket % (SubBuckets / 2) + SubBuckets / 2;
+	return sub_bucket << magnitude;
+}
+
+uint64_t Histogram::bucket_value(uint32_t bucket) {
+	if (bucket < SubBuckets) return bucket;
+	uint32_t magnitude = bucket / (SubBuckets / 2) - 1;
+	return bucket_min(bucket) + ((uint64_t(1) << magnitude) >> 1);
+}
+
+//---------------------------------
+
+//everything recorded by one thread:
+struct ThreadProfile {
+	std::string name;
+	std::array< Histogram, PhaseCount > phases;
+	std::atomic< uint64_t > overruns{0};
+
+	//(reporter only) totals at the last report, so reports cover just the time since:
+	std::array< std::vector< uint64_t >, PhaseCount > reported;
+	uint64_t reported_overruns = 0;
+};
+
+//all registered threads (only changed under the mutex; entries are never removed):
+static std::mutex &registry_mutex() {
+	static std::mutex mutex;
+	return mutex;
+}
+static std::list< std::unique_ptr< ThreadProfile > > &registry() {
+	static std::list< std::unique_ptr< ThreadProfile > > threads;
+	return threads;
+}
+
+static thread_local ThreadProfile *current = nullptr;
+
+void register_thread(std::string const &name) {
+	std::lock_guard< std::mutex > lock(registry_mutex());
+	registry().emplace_back(std::make_unique< ThreadProfile >());
+	current = registry().back().get();
+	current->name = name;
+}
+
+void count_overrun() {
+	if (!current) return;
+	current->overruns.store(current->overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+Scope::~Scope() {
+	if (!current) return;
+	auto elapsed = std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - start).count();
+	current->phases[phase].record(uint64_t(std::max< int64_t >(0, elapsed)));
+}
+
+std::string report() {
+	std::lock_guard< std::mutex > lock(registry_mutex());
+
+	//gather each phase's new samples (across all threads) since the last report:
+	std::array< std::vector< uint64_t >, PhaseCount > counts;
+	for (auto &counts_for_phase : counts) {
+		counts_for_phase.assign(Histogram::BucketCount, 0);
+	}
+	std::ostringstream overruns;
+	uint64_t total_overruns = 0;
+
+	for (auto &thread : registry()) {
+		for (uint32_t p = 0; p < PhaseCount; ++p) {
+			std::vector< uint64_t > &reported = thread->reported[p];
+			if (reported.empty()) reported.assign(Histogram::BucketCount, 0);
+			for (uint32_t b = 0; b < Histogram::BucketCount; ++b) {
+				uint64_t count = thread->phases[p].counts[b].load(std::memory_order_relaxed);
+				counts[p][b] += count - reported[b];
+				reported[b] = count;
+			}
+		}
+		uint64_t thread_overruns = thread->overruns.load(std::memory_order_relaxed);
+		if (thread_overruns != thread->reported_overruns) {
+			overruns << (total_overruns ? ", " : " (") << thread->name << ": " << (thread_overruns - thread->reported_overruns);
+			total_overruns += thread_overruns - thread->reported_overruns;
+			thread->reported_overruns = thread_overruns;
+		}
+	}
+
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(3);
+	for (uint32_t p = 0; p < PhaseCount; ++p) {
+		std::vector< uint64_t > const &histogram = counts[p];
+		uint64_t total = 0;
+		for (uint64_t count : histogram) total += count;
+		out << "  " << std::setw(10) << std::left << phase_name(Phase(p)) << std::right;
+		if (total == 0) {
+			out << " (no samples)\n";
+			continue;
+		}
+
+		//value at a given fraction of the way through the samples:
+		auto percentile = [&](double fraction) -> double {
+			uint64_t rank = std::min(total - 1, uint64_t(fraction * double(total)));
+			uint64_t seen = 0;
+			for (uint32_t b = 0; b < Histogram::BucketCount; ++b) {
+				seen += histogram[b];
+				if (seen > rank) return double(Histogram::bucket_value(b)) * 1e-6;
+			}
+			return 0.0;
+		};
+
+		out << " n " << std::setw(8) << total
+		    << "  p50 " << std::setw(8) << percentile(0.5)
+		    << "  p99 " << std::setw(8) << percentile(0.99)
+		    << "  p999 " << std::setw(8) << percentile(0.999)
+		    << "  max " << std::setw(8) << percentile(1.0) << " ms\n";
+	}
+	out << "  tick overruns: " << total_overruns;
+	if (total_overruns) out << overruns.str() << ")";
+	out << "\n";
+
+	return out.str();
+}
+
+} //namespace Profile
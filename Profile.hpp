@@ -0,0 +1,90 @@
+#pragma once
+
+/*
+ * Lightweight per-phase timing for the server's loops.
+ *
+ * Each thread that wants to record timings registers itself once:
+ *
+ *   Profile::register_thread("shard 0");
+ *
+ * and then wraps the work it wants measured in scoped timers:
+ *
+ *   {
+ *       Profile::Scope scope(Profile::Update);
+ *       game.update(Game::Tick);
+ *   }
+ *
+ * Durations go into that thread's own histograms, so recording never takes a lock
+ * (the counters are atomics written only by their owning thread).
+ * Some other thread periodically calls Profile::report() to summarize everything
+ * recorded since its last report.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace Profile {
+
+//parts of the server's work that get timed:
+enum Phase : uint8_t {
+	Poll, //(network thread) polling sockets (including idle waiting) and decoding client messages
+	Send, //(network thread) queuing state messages on connections
+	Update, //(simulation threads) Game::update for every room
+	Serialize, //(simulation threads) building state messages for every room
+	Tick, //(simulation threads) everything done in one tick
+	PhaseCount
+};
+
+//names used in reports:
+char const *phase_name(Phase phase);
+
+//High-dynamic-range histogram of durations (in nanoseconds):
+// values are bucketed by power of two, and each power of two is split into SubBuckets/2 linear steps,
+// so any value is recorded to within about 1/SubBuckets of its true size.
+struct Histogram {
+	static constexpr uint32_t SubBucketBits = 5;
+	static constexpr uint32_t SubBuckets = 1 << SubBucketBits;
+	static constexpr uint32_t MaxBits = 48; //values of 2^48 ns (about three days) and up are clamped
+	static constexpr uint32_t BucketCount = (MaxBits - SubBucketBits + 1) * (SubBuckets / 2) + SubBuckets / 2;
+
+	static uint32_t bucket_of(uint64_t value);
+	//smallest value that falls in bucket:
+	static uint64_t bucket_min(uint32_t bucket);
+	//a value representative of everything in bucket (middle of its range):
+	static uint64_t bucket_value(uint32_t bucket);
+
+	//(owning thread only) add a sample:
+	void record(uint64_t value) {
+		std::atomic< uint64_t > &count = counts[bucket_of(value)];
+		count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	std::array< std::atomic< uint64_t >, BucketCount > counts{};
+};
+
+//call once on each thread before using Scope or count_overrun on it:
+// (threads that never register just don't record anything)
+void register_thread(std::string const &name);
+
+//record that a tick's work ran past the start of the next tick:
+void count_overrun();
+
+//times the enclosing scope and records it under 'phase' for the current thread:
+struct Scope {
+	explicit Scope(Phase phase_) : phase(phase_), start(std::chrono::steady_clock::now()) { }
+	~Scope();
+	Scope(Scope const &) = delete;
+	Scope &operator=(Scope const &) = delete;
+
+	Phase phase;
+	std::chrono::steady_clock::time_point start;
+};
+
+//summary (counts, p50/p99/p999/max per phase, and tick overruns) of everything recorded since the last report:
+// (not thread-safe with itself: call from just one thread)
+std::string report();
+
+} //namespace Profile
@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+ * SPSCQueue is a fixed-capacity, lock-free queue for handing values from
+ * exactly one producer thread to exactly one consumer thread.
+ *
+ *   SPSCQueue< Event > events(1024);
+ *   //producer thread:
+ *   if (!events.try_push(std::move(event))) { ...queue is full... }
+ *   //consumer thread:
+ *   Event event;
+ *   while (events.try_pop(&event)) { ... }
+ *
+ * Slots are a power-of-two ring indexed by ever-increasing head/tail counters;
+ * each side only writes its own counter, so no locks or compare-exchanges are needed.
+ * (the two sides' counters are padded apart so the threads don't contend over a cache line)
+ */
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+
+template< typename T >
+struct SPSCQueue {
+	//capacity is rounded up to a power of two:
+	explicit SPSCQueue(size_t capacity) {
+		size_t size = 1;
+		while (size < capacity) size *= 2;
+		slots.resize(size);
+		mask = size - 1;
+	}
+	SPSCQueue(SPSCQueue const &) = delete;
+	SPSCQueue &operator=(SPSCQueue const &) = delete;
+
+	//(producer only) add a value to the back; returns false (and leaves 'value' alone) if the queue is full:
+	bool try_push(T &&value) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head_cache == slots.size()) {
+			head_cache = head.load(std::memory_order_acquire);
+			if (t - head_cache == slots.size()) return false;
+		}
+		slots[t & mask] = std::move(value);
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	//(consumer only) remove a value from the front; returns false if the queue is empty:
+	bool try_pop(T *value) {
+		assert(value);
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail_cache) {
+			tail_cache = tail.load(std::memory_order_acquire);
+			if (h == tail_cache) return false;
+		}
+		*value = std::move(slots[h & mask]);
+		slots[h & mask] = T(); //don't hold on to resources (e.g., shared blocks) after the value is gone
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	//internals:
+	std::vector< T > slots;
+	size_t mask = 0;
+
+	//consumer's side:
+	std::atomic< size_t > head{0}; //index of next value to pop
+	size_t tail_cache = 0; //consumer's last look at tail
+
+	//(padding instead of alignas, which MSVC warns about)
+	char padding[64];
+
+	//producer's side:
+	std::atomic< size_t > tail{0}; //index of next slot to push into
+	size_t head_cache = 0; //producer's last look at head
+};
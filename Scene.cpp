@@ -1,11 +1,11 @@
 #include "Scene.hpp"
 
 #include "gl_errors.hpp"
+#include "AssetPack.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <fstream>
 
 //-------------------------
 
@@ -168,11 +168,16 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 
 void Scene::load(std::string const &filename,
 	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+	MappedFile file(filename);
+	ChunkReader reader(file);
+	load(reader, on_drawable);
+}
 
-	std::ifstream file(filename, std::ios::binary);
+void Scene::load(ChunkReader &reader,
+	std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+	std::string const &filename = reader.name;
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	ChunkSpan< char > names = reader.read< char >("str0");
 
 	struct HierarchyEntry {
 		uint32_t parent;
@@ -183,8 +188,7 @@ void Scene::load(std::string const &filename,
 		glm::vec3 scale;
 	};
 	static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4*3 + 4*4 + 4*3, "HierarchyEntry is packed.");
-	std::vector< HierarchyEntry > hierarchy;
-	read_chunk(file, "xfh0", &hierarchy);
+	ChunkSpan< HierarchyEntry > hierarchy = reader.read< HierarchyEntry >("xfh0");
 
 	struct MeshEntry {
 		uint32_t transform;
@@ -192,8 +196,7 @@ void Scene::load(std::string const &filename,
 		uint32_t name_end;
 	};
 	static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-	std::vector< MeshEntry > meshes;
-	read_chunk(file, "msh0", &meshes);
+	ChunkSpan< MeshEntry > meshes = reader.read< MeshEntry >("msh0");
 
 	struct CameraEntry {
 		uint32_t transform;
@@ -202,8 +205,7 @@ void Scene::load(std::string const &filename,
 		float clip_near, clip_far;
 	};
 	static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-	std::vector< CameraEntry > loaded_cameras;
-	read_chunk(file, "cam0", &loaded_cameras);
+	ChunkSpan< CameraEntry > loaded_cameras = reader.read< CameraEntry >("cam0");
 
 	struct LightEntry {
 		uint32_t transform;
@@ -214,8 +216,7 @@ void Scene::load(std::string const &filename,
 		float fov;
 	};
 	static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-	std::vector< LightEntry > loaded_lights;
-	read_chunk(file, "lmp0", &loaded_lights);
+	ChunkSpan< LightEntry > loaded_lights = reader.read< LightEntry >("lmp0");
 
 
 	//--------------------------------
@@ -302,9 +303,9 @@ void Scene::load(std::string const &filename,
 	}
 
 	//load any extra that a subclass wants:
-	load_extra(file, names, hierarchy_transforms);
+	load_extra(reader, names, hierarchy_transforms);
 
-	if (file.peek() != EOF) {
+	if (!reader.at_end()) {
 		std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
 	}
 
@@ -318,6 +319,11 @@ Scene::Scene(std::string const &filename, std::function< void(Scene &, Transform
 	load(filename, on_drawable);
 }
 
+Scene::Scene(AssetPack const &pack, std::string const &name, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable) {
+	ChunkReader reader = pack.reader(name);
+	load(reader, on_drawable);
+}
+
 Scene::Scene(Scene const &other) {
 	set(other);
 }
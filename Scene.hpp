@@ -22,6 +22,11 @@
 #include <vector>
 #include <unordered_map>
 
+//(see AssetPack.hpp, read_write_chunk.hpp)
+struct AssetPack;
+struct ChunkReader;
+template< typename T > struct ChunkSpan;
+
 struct Scene {
 	struct Transform {
 		//Transform names are useful for debugging and looking up locations in a loaded scene:
@@ -134,16 +139,23 @@ struct Scene {
 	void load(std::string const &filename,
 		std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable = nullptr
 	);
+	//...from a file's chunks (e.g., a file in an asset pack, via AssetPack::reader):
+	void load(ChunkReader &reader,
+		std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable = nullptr
+	);
 
 	//this function is called to read extra chunks from the scene file after the main chunks are read:
 	// this is useful if you, e.g., subclassing scene to represent a game level/area
-	virtual void load_extra(std::istream &from, std::vector< char > const &str0, std::vector< Transform * > const &xfh0) { }
+	// (chunks and str0 point into the mapped scene file, so are only valid during the call)
+	virtual void load_extra(ChunkReader &from, ChunkSpan< char > const &str0, std::vector< Transform * > const &xfh0) { }
 
 	//empty scene:
 	Scene() = default;
 
 	//load a scene:
 	Scene(std::string const &filename, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
+	//...from a file in an asset pack:
+	Scene(AssetPack const &pack, std::string const &name, std::function< void(Scene &, Transform *, std::string const &) > const &on_drawable);
 
 	//copy a scene (with proper pointer fixup):
 	Scene(Scene const &); //...as a constructor
@@ -1,36 +1,84 @@
 #include "WalkMesh.hpp"
 
+#include "AssetPack.hpp"
 #include "read_write_chunk.hpp"
 
 #include <glm/gtx/norm.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <iostream>
-#include <fstream>
+#include <utility>
 #include <algorithm>
 #include <string>
 
-WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_)
-	: vertices(vertices_), normals(normals_), triangles(triangles_) {
+WalkMesh::WalkMesh(std::vector< glm::vec3 > vertices_, std::vector< glm::vec3 > normals_, std::vector< glm::uvec3 > triangles_)
+	: vertices(std::move(vertices_)), normals(std::move(normals_)), triangles(std::move(triangles_)) {
 
-	//construct next_vertex map (maps each edge to the next vertex in the triangle):
-	next_vertex.reserve(triangles.size()*3);
-	auto do_next = [this](uint32_t a, uint32_t b, uint32_t c) {
-		auto ret = next_vertex.insert(std::make_pair(glm::uvec2(a,b), c));
-		assert(ret.second);
-	};
-	for (auto const &tri : triangles) {
-		do_next(tri.x, tri.y, tri.z);
-		do_next(tri.y, tri.z, tri.x);
-		do_next(tri.z, tri.x, tri.y);
+	//construct per-triangle projections:
+	bases.resize(triangles.size());
+	for (uint32_t t = 0; t < triangles.size(); ++t) {
+		glm::uvec3 const &tri = triangles[t];
+		glm::vec3 const &a = vertices[tri.x];
+		glm::vec3 v0 = vertices[tri.y] - a;
+		glm::vec3 v1 = vertices[tri.z] - a;
+
+		//(solving the same system barycentric weights used to solve per-call -- only the right-hand side depends on the point)
+		float d00 = glm::dot(v0, v0);
+		float d01 = glm::dot(v0, v1);
+		float d11 = glm::dot(v1, v1);
+		float denom = d00 * d11 - d01 * d01;
+
+		TriangleBasis &basis = bases[t];
+		basis.origin = a;
+		basis.to_v = (d11 * v0 - d01 * v1) / denom;
+		basis.to_w = (d00 * v1 - d01 * v0) / denom;
+		basis.normal = glm::normalize(glm::cross(v0, v1));
+	}
+
+	//construct adjacency (by first finding which triangle edge each directed vertex pair is):
+	{
+		std::unordered_map< uint64_t, uint32_t > edge_of; //(a << 32 | b) -> (triangle << 2 | edge)
+		edge_of.reserve(triangles.size()*3);
+		auto key = [](uint32_t a, uint32_t b) { return (uint64_t(a) << 32) | uint64_t(b); };
+		for (uint32_t t = 0; t < triangles.size(); ++t) {
+			glm::uvec3 const &tri = triangles[t];
+			for (uint32_t e = 0; e < 3; ++e) {
+				auto ret = edge_of.emplace(key(tri[e], tri[(e+1)%3]), (t << 2) | e);
+				assert(ret.second); //(each directed edge must belong to only one triangle)
+			}
+		}
+
+		adjacency.resize(triangles.size());
+		for (uint32_t t = 0; t < triangles.size(); ++t) {
+			glm::uvec3 const &tri = triangles[t];
+			glm::vec3 const &normal = bases[t].normal;
+			for (uint32_t e = 0; e < 3; ++e) {
+				auto f = edge_of.find(key(tri[(e+1)%3], tri[e]));
+				if (f == edge_of.end()) {
+					adjacency[t].neighbour[e] = NoNeighbour;
+					adjacency[t].rotation[e] = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+					continue;
+				}
+				adjacency[t].neighbour[e] = f->second;
+
+				//rotation that takes this triangle's normal to the neighbour's normal:
+				// source: https://stackoverflow.com/questions/1171849/finding-quaternion-representing-the-rotation-from-one-vector-to-another
+				glm::vec3 const &other_normal = bases[f->second >> 2].normal;
+				glm::vec3 cross_norms = glm::cross(normal, other_normal);
+				glm::quat rotation;
+				rotation.x = cross_norms.x;
+				rotation.y = cross_norms.y;
+				rotation.z = cross_norms.z;
+				rotation.w = glm::dot(normal, other_normal) + 1;
+				adjacency[t].rotation[e] = glm::normalize(rotation);
+			}
+		}
 	}
 
 	//DEBUG: are vertex normals consistent with geometric normals?
-	for (auto const &tri : triangles) {
-		glm::vec3 const &a = vertices[tri.x];
-		glm::vec3 const &b = vertices[tri.y];
-		glm::vec3 const &c = vertices[tri.z];
-		glm::vec3 out = glm::normalize(glm::cross(b-a, c-a));
+	for (uint32_t t = 0; t < triangles.size(); ++t) {
+		glm::uvec3 const &tri = triangles[t];
+		glm::vec3 const &out = bases[t].normal;
 
 		float da = glm::dot(out, normals[tri.x]);
 		float db = glm::dot(out, normals[tri.y]);
@@ -38,86 +86,193 @@ WalkMesh::WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::
 
 		assert(da > 0.1f && db > 0.1f && dc > 0.1f);
 	}
+
+	build_bvh();
 }
 
-//project pt to the plane of triangle a,b,c and return the barycentric weights of the projected point:
-glm::vec3 barycentric_weights(glm::vec3 const &a, glm::vec3 const &b, glm::vec3 const &c, glm::vec3 const &pt) {
-	// use a formula for solving linear system of equations
-	glm::vec3 v0 = b - a, v1 = c - a, v2 = pt - a;
-	
-	float d00 = glm::dot(v0, v0);
-	float d01 = glm::dot(v0, v1);
-	float d11 = glm::dot(v1, v1);
-	float d20 = glm::dot(v2, v0);
-	float d21 = glm::dot(v2, v1);
-	float denom = d00 * d11 - d01 * d01;
-	float v = (d11 * d20 - d01 * d21) / denom;
-	float w = (d00 * d21 - d01 * d20) / denom;
-	float u = 1.0f - v - w;
-	
-	return glm::vec3(u, v, w);
+void WalkMesh::build_bvh() {
+	bvh_nodes.clear();
+	bvh_triangles.resize(triangles.size());
+	for (uint32_t t = 0; t < triangles.size(); ++t) {
+		bvh_triangles[t] = t;
+	}
+	if (triangles.empty()) return;
+
+	std::vector< glm::vec3 > centroids;
+	centroids.reserve(triangles.size());
+	for (auto const &tri : triangles) {
+		centroids.emplace_back((vertices[tri.x] + vertices[tri.y] + vertices[tri.z]) / 3.0f);
+	}
+
+	//nodes are built top-down, with an explicit stack of nodes whose triangles still need splitting:
+	bvh_nodes.reserve(2 * (triangles.size() / BVHLeafSize + 1));
+	bvh_nodes.emplace_back();
+	bvh_nodes[0].first = 0;
+	bvh_nodes[0].count = uint32_t(triangles.size());
+	std::vector< uint32_t > to_split(1, 0);
+	while (!to_split.empty()) {
+		uint32_t index = to_split.back();
+		to_split.pop_back();
+		uint32_t first = bvh_nodes[index].first;
+		uint32_t count = bvh_nodes[index].count;
+		auto begin = bvh_triangles.begin() + first;
+		auto end = begin + count;
+
+		//bounds of triangles, and of their centroids:
+		glm::vec3 min = glm::vec3( std::numeric_limits< float >::infinity());
+		glm::vec3 max = glm::vec3(-std::numeric_limits< float >::infinity());
+		glm::vec3 centroid_min = min, centroid_max = max;
+		for (auto t = begin; t != end; ++t) {
+			glm::uvec3 const &tri = triangles[*t];
+			for (uint32_t v : { tri.x, tri.y, tri.z }) {
+				min = glm::min(min, vertices[v]);
+				max = glm::max(max, vertices[v]);
+			}
+			centroid_min = glm::min(centroid_min, centroids[*t]);
+			centroid_max = glm::max(centroid_max, centroids[*t]);
+		}
+		bvh_nodes[index].min = min;
+		bvh_nodes[index].max = max;
+		if (count <= BVHLeafSize) continue;
+
+		//split at the median centroid along the axis where centroids are most spread out:
+		glm::vec3 extent = centroid_max - centroid_min;
+		uint32_t axis = (extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2));
+		auto middle = begin + count / 2;
+		std::nth_element(begin, middle, end, [&](uint32_t a, uint32_t b){
+			return centroids[a][axis] < centroids[b][axis];
+		});
+
+		uint32_t child = uint32_t(bvh_nodes.size());
+		bvh_nodes.emplace_back();
+		bvh_nodes.emplace_back();
+		bvh_nodes[child].first = first;
+		bvh_nodes[child].count = count / 2;
+		bvh_nodes[child + 1].first = first + count / 2;
+		bvh_nodes[child + 1].count = count - count / 2;
+		bvh_nodes[index].first = child;
+		bvh_nodes[index].count = 0;
+		to_split.emplace_back(child);
+		to_split.emplace_back(child + 1);
+	}
 }
 
-WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
-	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
+void WalkMesh::nearest_on_triangle(uint32_t triangle, glm::vec3 const &world_point, WalkPoint *closest_, float *closest_dis2_) const {
+	assert(closest_);
+	auto &closest = *closest_;
+	assert(closest_dis2_);
+	auto &closest_dis2 = *closest_dis2_;
 
-	WalkPoint closest;
-	float closest_dis2 = std::numeric_limits< float >::infinity();
+	closest_dis2 = std::numeric_limits< float >::infinity();
 
-	for (auto const &tri : triangles) {
-		//find closest point on triangle:
+	glm::uvec3 const &tri = triangles[triangle];
 
-		glm::vec3 const &a = vertices[tri.x];
-		glm::vec3 const &b = vertices[tri.y];
-		glm::vec3 const &c = vertices[tri.z];
+	//get barycentric coordinates of closest point in the plane of (a,b,c):
+	glm::vec3 coords = bases[triangle].weights(world_point);
 
-		//get barycentric coordinates of closest point in the plane of (a,b,c):
-		glm::vec3 coords = barycentric_weights(a,b,c, world_point);
+	//is that point inside the triangle?
+	if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
+		//yes, point is inside triangle.
+		float dis2 = glm::length2(world_point - to_world_point(WalkPoint(tri, coords)));
+		if (dis2 < closest_dis2) {
+			closest_dis2 = dis2;
+			closest.indices = tri;
+			closest.weights = coords;
+			closest.triangle = triangle;
+		}
+	} else {
+		//check triangle vertices and edges:
+		auto check_edge = [&world_point, &closest, &closest_dis2, triangle, this](uint32_t ai, uint32_t bi, uint32_t ci) {
+			glm::vec3 const &a = vertices[ai];
+			glm::vec3 const &b = vertices[bi];
+
+			//find closest point on line segment ab:
+			float along = glm::dot(world_point-a, b-a);
+			float max = glm::dot(b-a, b-a);
+			glm::vec3 pt;
+			glm::vec3 coords;
+			if (along < 0.0f) {
+				pt = a;
+				coords = glm::vec3(1.0f, 0.0f, 0.0f);
+			} else if (along > max) {
+				pt = b;
+				coords = glm::vec3(0.0f, 1.0f, 0.0f);
+			} else {
+				float amt = along / max;
+				pt = glm::mix(a, b, amt);
+				coords = glm::vec3(1.0f - amt, amt, 0.0f);
+			}
 
-		//is that point inside the triangle?
-		if (coords.x >= 0.0f && coords.y >= 0.0f && coords.z >= 0.0f) {
-			//yes, point is inside triangle.
-			float dis2 = glm::length2(world_point - to_world_point(WalkPoint(tri, coords)));
+			float dis2 = glm::length2(world_point - pt);
 			if (dis2 < closest_dis2) {
 				closest_dis2 = dis2;
-				closest.indices = tri;
+				closest.indices = glm::uvec3(ai, bi, ci);
 				closest.weights = coords;
+				closest.triangle = triangle;
 			}
-		} else {
-			//check triangle vertices and edges:
-			auto check_edge = [&world_point, &closest, &closest_dis2, this](uint32_t ai, uint32_t bi, uint32_t ci) {
-				glm::vec3 const &a = vertices[ai];
-				glm::vec3 const &b = vertices[bi];
-
-				//find closest point on line segment ab:
-				float along = glm::dot(world_point-a, b-a);
-				float max = glm::dot(b-a, b-a);
-				glm::vec3 pt;
-				glm::vec3 coords;
-				if (along < 0.0f) {
-					pt = a;
-					coords = glm::vec3(1.0f, 0.0f, 0.0f);
-				} else if (along > max) {
-					pt = b;
-					coords = glm::vec3(0.0f, 1.0f, 0.0f);
-				} else {
-					float amt = along / max;
-					pt = glm::mix(a, b, amt);
-					coords = glm::vec3(1.0f - amt, amt, 0.0f);
-				}
+		};
+		check_edge(tri.x, tri.y, tri.z);
+		check_edge(tri.y, tri.z, tri.x);
+		check_edge(tri.z, tri.x, tri.y);
+	}
+}
 
-				float dis2 = glm::length2(world_point - pt);
-				if (dis2 < closest_dis2) {
-					closest_dis2 = dis2;
-					closest.indices = glm::uvec3(ai, bi, ci);
-					closest.weights = coords;
-				}
-			};
-			check_edge(tri.x, tri.y, tri.z);
-			check_edge(tri.y, tri.z, tri.x);
-			check_edge(tri.z, tri.x, tri.y);
+WalkPoint WalkMesh::nearest_walk_point(glm::vec3 const &world_point) const {
+	assert(!triangles.empty() && "Cannot start on an empty walkmesh");
+
+	WalkPoint closest;
+	float closest_dis2 = std::numeric_limits< float >::infinity();
+	uint32_t closest_triangle = uint32_t(-1);
+
+	//squared distance from world_point to a node's box:
+	auto box_dis2 = [&world_point](BVHNode const &node) {
+		glm::vec3 outside = glm::max(node.min - world_point, glm::vec3(0.0f)) + glm::max(world_point - node.max, glm::vec3(0.0f));
+		return glm::dot(outside, outside);
+	};
+	//a box can only be skipped if it is clearly farther than the closest point so far
+	// (a triangle's distance, computed in floating point, may come out slightly under its box's):
+	auto can_skip = [&closest_dis2](float dis2) {
+		return dis2 > closest_dis2 * (1.0f + 1e-4f) + 1e-8f;
+	};
+
+	//branch and bound, visiting the nearer child first:
+	std::vector< std::pair< float, uint32_t > > stack; //(box distance, node)
+	stack.reserve(64);
+	stack.emplace_back(box_dis2(bvh_nodes[0]), 0);
+	while (!stack.empty()) {
+		auto [node_dis2, index] = stack.back();
+		stack.pop_back();
+		if (can_skip(node_dis2)) continue;
+
+		BVHNode const &node = bvh_nodes[index];
+		if (node.count == 0) {
+			float dis2_a = box_dis2(bvh_nodes[node.first]);
+			float dis2_b = box_dis2(bvh_nodes[node.first + 1]);
+			//(pushed far then near, so near is popped first)
+			if (dis2_a <= dis2_b) {
+				stack.emplace_back(dis2_b, node.first + 1);
+				stack.emplace_back(dis2_a, node.first);
+			} else {
+				stack.emplace_back(dis2_a, node.first);
+				stack.emplace_back(dis2_b, node.first + 1);
+			}
+			continue;
+		}
+
+		for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+			uint32_t t = bvh_triangles[i];
+			WalkPoint wp;
+			float dis2;
+			nearest_on_triangle(t, world_point, &wp, &dis2);
+			//(ties go to the lowest-numbered triangle, as if triangles were checked in order)
+			if (dis2 < closest_dis2 || (dis2 == closest_dis2 && t < closest_triangle)) {
+				closest = wp;
+				closest_dis2 = dis2;
+				closest_triangle = t;
+			}
 		}
 	}
+
 	assert(closest.indices.x < vertices.size());
 	assert(closest.indices.y < vertices.size());
 	assert(closest.indices.z < vertices.size());
@@ -132,14 +287,15 @@ void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, W
 	assert(time_);
 	auto &time = *time_;
 
-	glm::vec3 const &a = vertices[start.indices.x];
-	glm::vec3 const &b = vertices[start.indices.y];
-	glm::vec3 const &c = vertices[start.indices.z];
+	assert(start.triangle < triangles.size());
 
 	glm::vec3 step_coords;
 	{ //project 'step' into a barycentric-coordinates direction:
-		glm::vec3 step_plus_a = barycentric_weights(a, b, c, step + a);
-		step_coords = step_plus_a - glm::vec3(1,0,0);
+		// (bases are in the triangle's own vertex order, while start.indices may be a rotation of it)
+		glm::vec3 delta = bases[start.triangle].weights_delta(step);
+		glm::uvec3 const &tri = triangles[start.triangle];
+		uint32_t first = (start.indices.x == tri.x ? 0 : (start.indices.x == tri.y ? 1 : 2));
+		step_coords = glm::vec3(delta[first], delta[(first+1)%3], delta[(first+2)%3]);
 	}
 	
 	//if no edge is crossed, event will just be taking the whole step:
@@ -188,6 +344,8 @@ void WalkMesh::walk_in_triangle(WalkPoint const &start, glm::vec3 const &step, W
 		// no need to reorder
 		end.weights.z = 0.0f;
 	}
+	//(keep weights summing to one after snapping the small one to zero, so the error can't build up over many edges)
+	if (end.weights.z == 0.0f) end.weights /= end.weights.x + end.weights.y;
 }
 
 // move from one triangle to another
@@ -199,34 +357,28 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 	auto &rotation = *rotation_;
 
 	assert(start.weights.z == 0.0f); //*must* be on an edge.
-	glm::uvec2 edge = glm::uvec2(start.indices);
+	assert(start.triangle < triangles.size());
+
+	//which edge of the triangle is start.indices.xy?
+	glm::uvec3 const &tri = triangles[start.triangle];
+	uint32_t edge = (start.indices.x == tri.x ? 0 : (start.indices.x == tri.y ? 1 : 2));
+	assert(start.indices.y == tri[(edge+1)%3]);
 
 	//check if 'edge' is a non-boundary edge:
-	auto third_vertex_itr = next_vertex.find(glm::uvec2(edge.y, edge.x));
-	if (third_vertex_itr != next_vertex.end()) {
+	uint32_t neighbour = adjacency[start.triangle].neighbour[edge];
+	if (neighbour != NoNeighbour) {
 		//it is!
-		uint32_t third_vertex = third_vertex_itr->second;
-
 		//make 'end' represent the same (world) point, but on triangle (edge.y, edge.x, [other point]):
-		glm::vec3 world_start = to_world_point(start);
-		end.indices = glm::uvec3(edge.y, edge.x, third_vertex);
-		end.weights = barycentric_weights(vertices[end.indices.x], 
-			vertices[end.indices.y], vertices[end.indices.z], world_start); 
-
-		//make 'rotation' the rotation that takes (start.indices)'s normal to (end.indices)'s normal:
-		// source: https://stackoverflow.com/questions/1171849/finding-quaternion-representing-the-rotation-from-one-vector-to-another
-		{
-			glm::vec3 start_norm = to_world_triangle_normal(start);
-			glm::vec3 end_norm = to_world_triangle_normal(end);
-
-			glm::vec3 cross_norms = glm::cross(start_norm, end_norm);
-			rotation.x = cross_norms.x;
-			rotation.y = cross_norms.y;
-			rotation.z = cross_norms.z;
-			rotation.w = glm::dot(start_norm, end_norm) + 1;
-
-			rotation = glm::normalize(rotation);
-		}
+		// (same point on the shared edge, so the weights just swap)
+		uint32_t other_edge = neighbour & 3;
+		glm::uvec3 const &other = triangles[neighbour >> 2];
+		end.indices = glm::uvec3(other[other_edge], other[(other_edge+1)%3], other[(other_edge+2)%3]);
+		end.weights = glm::vec3(start.weights.y, start.weights.x, 0.0f);
+		end.triangle = neighbour >> 2;
+		assert(end.indices.x == start.indices.y && end.indices.y == start.indices.x);
+
+		//rotation that takes (start.indices)'s normal to (end.indices)'s normal:
+		rotation = adjacency[start.triangle].rotation[edge];
 
 		return true;
 	} else {
@@ -236,21 +388,86 @@ bool WalkMesh::cross_edge(WalkPoint const &start, WalkPoint *end_, glm::quat *ro
 	}
 }
 
+bool WalkMesh::walk(WalkPoint *at_, glm::vec3 remain) const {
+	assert(at_);
+	auto &at = *at_;
+
+	//using a for() instead of a while() here so that if walkpoint gets stuck in
+	// some awkward case, code will not infinite loop:
+	for (uint32_t iter = 0; iter < 10; ++iter) {
+		if (remain == glm::vec3(0.0f)) break;
+		WalkPoint end;
+		float time;
+		walk_in_triangle(at, remain, &end, &time);
+		at = end;
+		if (time == 1.0f) {
+			//finished within triangle:
+			remain = glm::vec3(0.0f);
+			break;
+		}
+		//some step remains:
+		remain *= (1.0f - time);
+		//try to step over edge:
+		glm::quat rotation;
+		if (cross_edge(at, &end, &rotation)) {
+			//stepped to a new triangle:
+			at = end;
+			//rotate step to follow surface:
+			remain = rotation * remain;
+		} else {
+			//ran into a wall, bounce / slide along it:
+			glm::vec3 const &a = vertices[at.indices.x];
+			glm::vec3 const &b = vertices[at.indices.y];
+			glm::vec3 along = glm::normalize(b-a);
+			glm::vec3 const &normal = bases[at.triangle].normal;
+			glm::vec3 in = glm::cross(normal, along);
+
+			//check how much 'remain' is pointing out of the triangle:
+			float d = glm::dot(remain, in);
+			if (d < 0.0f) {
+				//bounce off of the wall:
+				remain += (-1.25f * d) * in;
+			} else {
+				//if it's just pointing along the edge, bend slightly away from wall:
+				remain += 0.01f * d * in;
+			}
+		}
+	}
 
-WalkMeshes::WalkMeshes(std::string const &filename) {
-	std::ifstream file(filename, std::ios::binary);
+	return remain == glm::vec3(0.0f);
+}
+
+uint32_t WalkMesh::step_batch(WalkPoint *at, glm::vec3 const *steps, uint32_t count) const {
+	assert(at || count == 0);
+	assert(steps || count == 0);
+
+	uint32_t unfinished = 0;
+	for (uint32_t i = 0; i < count; ++i) {
+		if (!walk(&at[i], steps[i])) unfinished += 1;
+	}
+	return unfinished;
+}
 
-	std::vector< glm::vec3 > vertices;
-	read_chunk(file, "p...", &vertices);
 
-	std::vector< glm::vec3 > normals;
-	read_chunk(file, "n...", &normals);
+WalkMeshes::WalkMeshes(std::string const &filename) {
+	MappedFile file(filename);
+	ChunkReader reader(file);
+	load(reader);
+}
+
+WalkMeshes::WalkMeshes(AssetPack const &pack, std::string const &name) {
+	ChunkReader reader = pack.reader(name);
+	load(reader);
+}
 
-	std::vector< glm::uvec3 > triangles;
-	read_chunk(file, "tri0", &triangles);
+void WalkMeshes::load(ChunkReader &reader) {
+	//(chunks are read in place; only each walkmesh's own copy of its data gets allocated)
+	std::string const &filename = reader.name;
 
-	std::vector< char > names;
-	read_chunk(file, "str0", &names);
+	ChunkSpan< glm::vec3 > vertices = reader.read< glm::vec3 >("p...");
+	ChunkSpan< glm::vec3 > normals = reader.read< glm::vec3 >("n...");
+	ChunkSpan< glm::uvec3 > triangles = reader.read< glm::uvec3 >("tri0");
+	ChunkSpan< char > names = reader.read< char >("str0");
 
 	struct IndexEntry {
 		uint32_t name_begin, name_end;
@@ -258,10 +475,9 @@ WalkMeshes::WalkMeshes(std::string const &filename) {
 		uint32_t triangle_begin, triangle_end;
 	};
 
-	std::vector< IndexEntry > index;
-	read_chunk(file, "idxA", &index);
+	ChunkSpan< IndexEntry > index = reader.read< IndexEntry >("idxA");
 
-	if (file.peek() != EOF) {
+	if (!reader.at_end()) {
 		std::cerr << "WARNING: trailing data in walkmesh file '" << filename << "'" << std::endl;
 	}
 
@@ -282,7 +498,7 @@ WalkMeshes::WalkMeshes(std::string const &filename) {
 			throw std::runtime_error("Invalid triangle indices in index of '" + filename + "'");
 		}
 
-		//copy vertices/normals:
+		//copy vertices/normals (straight from the file into the walkmesh):
 		std::vector< glm::vec3 > wm_vertices(vertices.begin() + e.vertex_begin, vertices.begin() + e.vertex_end);
 		std::vector< glm::vec3 > wm_normals(normals.begin() + e.vertex_begin, normals.begin() + e.vertex_end);
 
@@ -304,7 +520,7 @@ WalkMeshes::WalkMeshes(std::string const &filename) {
 		std::string name(names.begin() + e.name_begin, names.begin() + e.name_end);
 		std::cout << name << std::endl;
 
-		auto ret = meshes.emplace(name, WalkMesh(wm_vertices, wm_normals, wm_triangles));
+		auto ret = meshes.emplace(name, WalkMesh(std::move(wm_vertices), std::move(wm_normals), std::move(wm_triangles)));
 		if (!ret.second) {
 			throw std::runtime_error("WalkMesh with duplicated name '" + name + "' in '" + filename + "'");
 		}
@@ -1,12 +1,17 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp> //allows the use of 'uvec2' as an unordered_map key
+#include <glm/gtc/quaternion.hpp>
 
+#include <array>
 #include <vector>
 #include <string>
 #include <unordered_map>
 
+//(see AssetPack.hpp, read_write_chunk.hpp)
+struct AssetPack;
+struct ChunkReader;
+
 //"WalkPoint" represents location on the WalkMesh as barycentric coordinates on a triangle:
 struct WalkPoint {
 	//indices of current triangle (in CCW order):
@@ -14,7 +19,9 @@ struct WalkPoint {
 	//barycentric coordinates for current point:
 	glm::vec3 weights = glm::vec3(std::numeric_limits< float >::quiet_NaN());
 	//NOTE: by convention, if WalkPoint is on an edge, indices/weights will be arranged so that weights.z will be 0.0.
-	WalkPoint(glm::uvec3 const &indices_, glm::vec3 const &weights_) : indices(indices_), weights(weights_) { }
+	//index of current triangle in WalkMesh::triangles (indices is a rotation of that triangle's vertices):
+	uint32_t triangle = -1U;
+	WalkPoint(glm::uvec3 const &indices_, glm::vec3 const &weights_, uint32_t triangle_ = -1U) : indices(indices_), weights(weights_), triangle(triangle_) { }
 	WalkPoint() = default;
 };
 
@@ -24,16 +31,68 @@ struct WalkMesh {
 	std::vector< glm::vec3 > normals; //normals for interpolated 'up' direction
 	std::vector< glm::uvec3 > triangles; //CCW-oriented
 
-	//This "next vertex" map includes [a,b]->c, [b,c]->a, and [c,a]->b for each triangle (a,b,c), and is useful for checking what's over an edge from a given point:
-	std::unordered_map< glm::uvec2, uint32_t > next_vertex;
-
-	//Construct new WalkMesh and build next_vertex structure:
-	WalkMesh(std::vector< glm::vec3 > const &vertices_, std::vector< glm::vec3 > const &normals_, std::vector< glm::uvec3 > const &triangles_);
+	//What's over each edge of each triangle, for crossing edges without searching:
+	// edge 0 of triangle (a,b,c) is a->b, edge 1 is b->c, and edge 2 is c->a.
+	struct TriangleAdjacency {
+		//(neighbouring triangle << 2) | (which of its edges is this edge, reversed); or NoNeighbour for a boundary edge:
+		std::array< uint32_t, 3 > neighbour;
+		//rotation that brings vectors in this triangle's plane into the neighbour's plane:
+		std::array< glm::quat, 3 > rotation;
+	};
+	inline static constexpr uint32_t NoNeighbour = -1U;
+	std::vector< TriangleAdjacency > adjacency; //parallel to triangles
+
+	//Precomputed per-triangle projection, so finding barycentric weights is two dot products:
+	// a point p projected to the plane of triangle (a,b,c) has weights (1-v-w, v, w),
+	// with v = dot(to_v, p - origin) and w = dot(to_w, p - origin).
+	// (padded to exactly one cache line, so each triangle's basis is a single line fetch)
+	struct alignas(64) TriangleBasis {
+		glm::vec3 origin = glm::vec3(0.0f); //the triangle's first vertex
+		glm::vec3 to_v = glm::vec3(0.0f); //rows of the 2x3 inverse of [b-a, c-a] (restricted to the triangle's plane)
+		glm::vec3 to_w = glm::vec3(0.0f);
+		glm::vec3 normal = glm::vec3(0.0f); //unit face normal (CCW)
+		float padding[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		//barycentric weights of p projected to the triangle's plane:
+		glm::vec3 weights(glm::vec3 const &p) const {
+			glm::vec3 d = p - origin;
+			float v = glm::dot(to_v, d);
+			float w = glm::dot(to_w, d);
+			return glm::vec3(1.0f - v - w, v, w);
+		}
+		//change in barycentric weights from moving by a step:
+		glm::vec3 weights_delta(glm::vec3 const &step) const {
+			float v = glm::dot(to_v, step);
+			float w = glm::dot(to_w, step);
+			return glm::vec3(-v - w, v, w);
+		}
+	};
+	static_assert(sizeof(TriangleBasis) == 64, "TriangleBasis should fill one cache line.");
+	std::vector< TriangleBasis > bases; //parallel to triangles
+
+	//Construct new WalkMesh and build adjacency and bvh structures:
+	// (takes its vertex and triangle arrays by value, so callers done with theirs can move them in)
+	WalkMesh(std::vector< glm::vec3 > vertices_, std::vector< glm::vec3 > normals_, std::vector< glm::uvec3 > triangles_);
 
 	//used to initialize walking -- finds the closest point on the walk mesh:
-	// (should only need to call this at the start of a level)
+	// (also used for respawns and resyncs; searches the bvh, so takes time logarithmic in the number of triangles)
+	//if several triangles are equally close, the lowest-numbered one is used
 	WalkPoint nearest_walk_point(glm::vec3 const &world_point) const;
 
+	//closest point to world_point on one triangle, and its squared distance:
+	void nearest_on_triangle(uint32_t triangle, glm::vec3 const &world_point, WalkPoint *closest, float *closest_dis2) const;
+
+	//bounding volume hierarchy over the triangles (axis-aligned boxes, split at the median along the longest axis):
+	struct BVHNode {
+		glm::vec3 min = glm::vec3(0.0f);
+		glm::vec3 max = glm::vec3(0.0f);
+		uint32_t first = 0; //leaf: first entry in bvh_triangles; interior: index of first child (the second child follows it)
+		uint32_t count = 0; //leaf: number of triangles (> 0); interior: 0
+	};
+	inline static constexpr uint32_t BVHLeafSize = 4;
+	std::vector< BVHNode > bvh_nodes; //root is bvh_nodes[0] (if there are any triangles)
+	std::vector< uint32_t > bvh_triangles; //triangle indices, in leaf order
+	void build_bvh();
+
 
 	//take a step on a triangle, stopping at edges:
 	//  if the step stays within the triangle:
@@ -58,12 +117,23 @@ struct WalkMesh {
 	//    - end->weights is the other triangle along start.triangle.xy
 	//    - *rotation brings vectors in the plane of start.triangle.xyz to vectors in the plane of end->triangle.xyz
 	//    - function returns true
+	//  (looks up adjacency, so start.triangle must be set -- as it is for walkpoints from nearest_walk_point and walking)
 	bool cross_edge(
 		WalkPoint const &start, //[in] walkpoint on triangle edge
 		WalkPoint *end,         //[out] end walkpoint, having crossed edge
 		glm::quat *rotation     //[out] rotation over edge
 	) const;
 
+	//walk a whole step along the mesh: crosses edges onto neighbouring triangles, and bounces / slides along boundary walls:
+	// (used by both the client and the server, so that predicted movement matches the server's)
+	//returns false if the step couldn't be finished within the iteration budget
+	bool walk(WalkPoint *at, glm::vec3 step) const;
+
+	//walk many agents at once: at[i] takes steps[i], for i in [0,count), just as walk() would:
+	// (agents are independent, so disjoint ranges may be stepped on different threads at the same time)
+	//returns the number of agents that couldn't finish within the iteration budget
+	uint32_t step_batch(WalkPoint *at, glm::vec3 const *steps, uint32_t count) const;
+
 	//used to read back results of walking:
 	glm::vec3 to_world_point(WalkPoint const &wp) const {
 		//if you were looking here for the lesson solution, well, here you go:
@@ -84,6 +154,7 @@ struct WalkMesh {
 
 	//read back a triangle normal at a walkpoint:
 	glm::vec3 to_world_triangle_normal(WalkPoint const &wp) const {
+		if (wp.triangle < bases.size()) return bases[wp.triangle].normal;
 		glm::vec3 const &a = vertices[wp.indices.x];
 		glm::vec3 const &b = vertices[wp.indices.y];
 		glm::vec3 const &c = vertices[wp.indices.z];
@@ -95,6 +166,10 @@ struct WalkMesh {
 struct WalkMeshes {
 	//load a list of named WalkMeshes from a file:
 	WalkMeshes(std::string const &filename);
+	//...or from a file in an asset pack:
+	WalkMeshes(AssetPack const &pack, std::string const &name);
+	//(both read the file's chunks here)
+	void load(ChunkReader &reader);
 
 	//retrieve a WalkMesh by name:
 	WalkMesh const &lookup(std::string const &name) const;
@@ -0,0 +1,114 @@
+//Microbenchmark for minesweeper neighbour counting (see count_neighbours.hpp):
+// times the bounds-checked per-cell counting the game used to do in Game::map_setup
+// against each count_neighbours version, at a few board sizes, and checks they all agree.
+
+#include "count_neighbours.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+//the old approach: look up each of the eight neighbours through a bounds-checked helper:
+static void count_neighbours_reference(std::vector< int8_t > const &layout, uint32_t size, std::vector< int8_t > *counts_) {
+	auto &counts = *counts_;
+	auto get_layout = [&](int64_t i, int64_t j) {
+		if (i >= 0 && i < int64_t(size) && j >= 0 && j < int64_t(size))
+			return layout[size_t(i) * size + size_t(j)] == -1;
+		else
+			return false;
+	};
+	for (int64_t i = 0; i < int64_t(size); i++) {
+		for (int64_t j = 0; j < int64_t(size); j++) {
+			if (layout[size_t(i) * size + size_t(j)] == -1) {
+				counts[size_t(i) * size + size_t(j)] = -1;
+				continue;
+			}
+			counts[size_t(i) * size + size_t(j)] = int8_t(get_layout(i-1, j-1) + get_layout(i, j-1) + get_layout(i-1, j)
+				+ get_layout(i+1, j+1) + get_layout(i, j+1) + get_layout(i+1, j)
+				+ get_layout(i+1, j-1) + get_layout(i-1, j+1));
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	std::vector< uint32_t > sizes{ 10, 1000, 10000 };
+	if (argc > 1) {
+		sizes.clear();
+		for (int arg = 1; arg < argc; ++arg) {
+			int size = std::atoi(argv[arg]);
+			if (size < 1) {
+				std::cerr << "Usage:\n\t./benchmark-neighbours [board size ...]" << std::endl;
+				return 1;
+			}
+			sizes.emplace_back(uint32_t(size));
+		}
+	}
+
+	for (uint32_t size : sizes) {
+		//random board with 10% mines, in both layouts:
+		std::mt19937 mt(0x15466666);
+		std::vector< int8_t > layout(size_t(size) * size, 0);
+		std::vector< uint8_t > padded(size_t(size + 2) * (size + 2), 0);
+		for (uint32_t y = 0; y < size; ++y) {
+			for (uint32_t x = 0; x < size; ++x) {
+				if (mt() % 10 == 0) {
+					layout[size_t(y) * size + x] = -1;
+					padded[size_t(y + 1) * (size + 2) + (x + 1)] = 1;
+				}
+			}
+		}
+
+		std::vector< int8_t > expected(layout.size());
+		std::vector< int8_t > counts(layout.size());
+
+		//run each version enough times to take a while, and report the best time per board:
+		auto time = [&](std::function< void() > const &run) {
+			double best = std::numeric_limits< double >::infinity();
+			double total = 0.0;
+			uint32_t runs = 0;
+			while (runs < 3 || (total < 0.25 && runs < 100000)) {
+				auto before = std::chrono::steady_clock::now();
+				run();
+				double elapsed = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+				best = std::min(best, elapsed);
+				total += elapsed;
+				runs += 1;
+			}
+			return best;
+		};
+
+		std::cout << "Board " << size << "x" << size << ":" << std::endl;
+		double reference = time([&](){ count_neighbours_reference(layout, size, &expected); });
+
+		auto report = [&](std::string const &name, double seconds, bool checked) {
+			std::cout << "  " << std::setw(10) << std::left << name << std::right
+			          << std::setw(12) << std::fixed << std::setprecision(2) << (seconds * 1e6) << " us"
+			          << std::setw(10) << std::setprecision(2) << (double(layout.size()) / seconds * 1e-9) << " Gcells/s"
+			          << std::setw(8) << std::setprecision(1) << (reference / seconds) << "x";
+			if (checked) std::cout << (counts == expected ? "" : "  MISMATCH");
+			std::cout << std::endl;
+		};
+		report("reference", reference, false);
+
+		auto run_version = [&](std::string const &name, void (*version)(uint8_t const *, uint32_t, uint32_t, int8_t *, size_t)) {
+			std::fill(counts.begin(), counts.end(), int8_t(0x55));
+			double seconds = time([&](){ version(padded.data(), size, size, counts.data(), size); });
+			report(name, seconds, true);
+		};
+		run_version("scalar", count_neighbours_scalar);
+		#ifdef COUNT_NEIGHBOURS_X86
+		run_version("sse2", count_neighbours_sse2);
+		if (cpu_has_avx2()) run_version("avx2", count_neighbours_avx2);
+		else std::cout << "  (avx2 not supported on this CPU)" << std::endl;
+		#endif
+	}
+
+	return 0;
+}
@@ -0,0 +1,365 @@
+//Headless load generator: connects many simulated players ("bots") to a server,
+// walks them around the WalkMesh, and reports how well the server keeps up.
+
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "WalkMesh.hpp"
+#include "data_path.hpp"
+#include "AssetPack.hpp"
+
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+typedef std::chrono::steady_clock Clock;
+
+//measurements gathered by each worker thread and combined at the end:
+struct Stats {
+	std::vector< float > tick_jitter; //seconds between state arrivals, minus the expected number of ticks
+	std::vector< float > round_trip; //seconds from sending an input until a state with it applied arrives
+	uint64_t states = 0; //state messages received
+	uint64_t bytes_in = 0; //bytes received (over either channel; from Connection::bytes_received)
+	uint64_t bytes_out = 0; //bytes sent (over either channel; from Connection::bytes_sent)
+	uint64_t malformed = 0; //bots disconnected for getting a malformed message from the server
+
+	void merge(Stats const &other) {
+		tick_jitter.insert(tick_jitter.end(), other.tick_jitter.begin(), other.tick_jitter.end());
+		round_trip.insert(round_trip.end(), other.round_trip.begin(), other.round_trip.end());
+		states += other.states;
+		bytes_in += other.bytes_in;
+		bytes_out += other.bytes_out;
+		malformed += other.malformed;
+	}
+};
+
+struct Bot {
+	Bot(std::string const &host, std::string const &port) : client(host, port) { }
+	Client client;
+	Game game; //state as received from the server
+	Player local; //what gets sent to the server (local.inputs are the inputs not yet applied)
+
+	//walking (inputs sampled once per Game::Tick and predicted, as in PlayMode):
+	WalkPoint at;
+	bool placed = false; //has the bot been moved to its start position yet?
+	float heading = 0.0f; //direction of travel (radians around +z)
+	float turn_timer = 0.0f; //seconds until heading changes
+	float input_accumulator = 0.0f;
+	uint32_t next_input_seq = 1;
+
+	//for measuring round trip time: recently sampled inputs and when they were first sent
+	std::deque< std::pair< uint32_t, Clock::time_point > > sent;
+	//for measuring tick jitter: the last state received
+	uint32_t last_seq = 0;
+	Clock::time_point last_state;
+};
+
+//advance one bot by one frame: walk, send controls, and handle whatever the server sent:
+static void update_bot(Bot &bot, WalkMesh const &walkmesh, float elapsed, std::mt19937 &mt, Stats &stats) {
+	Connection &connection = bot.client.connection;
+	if (!connection) return;
+	uint64_t sent_before = connection.bytes_sent;
+	uint64_t received_before = connection.bytes_received;
+
+	if (bot.placed) {
+		//wander: pick a new direction every so often:
+		bot.turn_timer -= elapsed;
+		if (bot.turn_timer <= 0.0f) {
+			bot.heading = std::uniform_real_distribution< float >(0.0f, 6.2831853f)(mt);
+			bot.turn_timer = std::uniform_real_distribution< float >(0.5f, 2.0f)(mt);
+		}
+		bot.local.controls.up.pressed = true;
+
+		bot.input_accumulator = std::min(bot.input_accumulator + elapsed, 4.0f * Game::Tick);
+		bool sampled = false;
+		while (bot.input_accumulator >= Game::Tick) {
+			bot.input_accumulator -= Game::Tick;
+			//('up' walks along the facing's +y, so face a quarter turn clockwise of the heading)
+			Player::Input input = bot.local.sample_input(bot.next_input_seq++, bot.heading - 1.5707963f);
+			//(bots don't interpolate, so they see other players as of the latest snapshot)
+			if (!bot.game.snapshots.empty()) input.view = bot.game.snapshots.back().seq * Player::ViewSteps;
+			walkmesh.walk(&bot.at, Player::input_step(input));
+			bot.local.inputs.emplace_back(input);
+			if (bot.local.inputs.size() > 64) bot.local.inputs.erase(bot.local.inputs.begin());
+			//(remember when, to match against the state that reports it applied)
+			bot.sent.emplace_back(input.seq, Clock::now());
+			if (bot.sent.size() > 64) bot.sent.pop_front();
+			sampled = true;
+		}
+
+		if (sampled) {
+			bot.local.send_controls_message(&connection, Connection::Unreliable);
+		}
+	}
+
+	bot.client.poll([&](Connection *c, Connection::Event event){
+		if (event == Connection::OnClose) {
+			std::cerr << "Bot lost connection to server." << std::endl;
+			return;
+		}
+		if (event != Connection::OnRecv) return;
+
+		bool got_state = false;
+		try {
+			while (bot.game.recv_state_message(c)) {
+				got_state = true;
+			}
+		} catch (std::exception const &e) {
+			//(as PlayMode would quit, just this bot stops)
+			std::cerr << "[" << c->socket << "] malformed message from server: " << e.what() << std::endl;
+			stats.malformed += 1;
+			c->close();
+			return;
+		}
+		if (!got_state || bot.game.snapshots.empty()) return;
+
+		//only ack and measure snapshots that are newer than the last one:
+		// (stale or duplicated states are parsed too, but leave the newest snapshot as it was)
+		uint32_t seq = bot.game.snapshots.back().seq;
+		if (seq == bot.last_seq) return;
+		bot.game.send_ack_message(c, Connection::Unreliable);
+		auto now = Clock::now();
+		stats.states += 1;
+		if (bot.last_seq != 0) {
+			float interval = std::chrono::duration< float >(now - bot.last_state).count();
+			stats.tick_jitter.emplace_back(std::abs(interval - float(seq - bot.last_seq) * Game::Tick));
+		}
+		bot.last_seq = seq;
+		bot.last_state = now;
+
+		if (bot.game.players.empty()) return;
+		//(recv_state_message moves our own player to the front)
+		glm::vec3 const &start_position = bot.game.players.start_position.front();
+
+		if (!bot.placed && start_position != glm::vec3(0.0f)) {
+			//start walking from the position the server picked:
+			bot.at = walkmesh.nearest_walk_point(start_position);
+			bot.placed = true;
+			return;
+		}
+
+		//stop sending inputs the server has applied:
+		auto &inputs = bot.local.inputs;
+		inputs.erase(inputs.begin(), std::find_if(inputs.begin(), inputs.end(), [&](Player::Input const &input){ return input.seq > bot.game.last_input; }));
+
+		//round trip: time since the newest applied input was sent:
+		auto applied = std::find_if(bot.sent.rbegin(), bot.sent.rend(), [&](auto const &s){ return s.first <= bot.game.last_input; });
+		if (applied != bot.sent.rend()) {
+			stats.round_trip.emplace_back(std::chrono::duration< float >(now - applied->second).count());
+			bot.sent.erase(bot.sent.begin(), applied.base());
+		}
+	}, 0.0);
+
+	stats.bytes_out += connection.bytes_sent - sent_before;
+	stats.bytes_in += connection.bytes_received - received_before;
+}
+
+//p-th percentile (0-100) of a list of samples:
+static float percentile(std::vector< float > &samples, float p) {
+	if (samples.empty()) return 0.0f;
+	size_t index = std::min(samples.size() - 1, size_t(p / 100.0f * float(samples.size())));
+	std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+	return samples[index];
+}
+
+//CPU time (user + system) used so far by process 'pid', in seconds (or -1 if not available):
+static double process_cpu_seconds(int pid) {
+	#ifdef __linux__
+	std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+	std::string line;
+	if (!std::getline(stat, line)) return -1.0;
+	//fields after the (parenthesized, possibly space-containing) command name:
+	size_t close = line.rfind(')');
+	if (close == std::string::npos) return -1.0;
+	std::istringstream fields(line.substr(close + 2));
+	std::string field;
+	unsigned long long utime = 0, stime = 0;
+	for (uint32_t i = 3; i <= 15 && (fields >> field); ++i) {
+		if (i == 14) utime = std::stoull(field);
+		if (i == 15) stime = std::stoull(field);
+	}
+	return double(utime + stime) / double(sysconf(_SC_CLK_TCK));
+	#else
+	(void)pid;
+	return -1.0;
+	#endif
+}
+
+int main(int argc, char **argv) {
+#ifdef _WIN32
+	//when compiled on windows, unhandled exceptions don't have their message printed, which can make debugging simple issues difficult.
+	try {
+#endif
+
+	//------------ argument parsing ------------
+
+	auto usage = [&](){
+		std::cerr << "Usage:\n\t./bot-client <host> <port> [--bots <count>] [--seconds <duration>] [--rate <frames per second>] [--threads <count>] [--server-pid <pid>]\n"
+		          << "\t\t[--udp-loss <fraction>] [--udp-latency <seconds>] [--udp-jitter <seconds>]" << std::endl;
+	};
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+	std::string host = argv[1];
+	std::string port = argv[2];
+
+	uint32_t bot_count = 1000;
+	float seconds = 30.0f;
+	float rate = 60.0f; //bot "frames" per second (each frame: walk, send controls, poll)
+	uint32_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+	int server_pid = -1; //if given, report the server's CPU use (read from /proc)
+	UnreliableShim unreliable_shim;
+
+	for (int arg = 3; arg < argc; /*advanced below*/) {
+		std::string name = argv[arg];
+		if (unreliable_shim.parse_argument(argc, argv, &arg)) continue;
+		if (arg + 1 >= argc) {
+			usage();
+			return 1;
+		}
+		char const *value = argv[arg + 1];
+		if (name == "--bots") bot_count = uint32_t(std::max(1, std::atoi(value)));
+		else if (name == "--seconds") seconds = std::max(0.1f, float(std::atof(value)));
+		else if (name == "--rate") rate = std::max(1.0f, float(std::atof(value)));
+		else if (name == "--threads") thread_count = uint32_t(std::max(1, std::atoi(value)));
+		else if (name == "--server-pid") server_pid = std::atoi(value);
+		else {
+			std::cerr << "Unrecognized argument '" << name << "'." << std::endl;
+			usage();
+			return 1;
+		}
+		arg += 2;
+	}
+
+	//------------ initialization ------------
+
+	//the same walkmesh PlayMode walks on:
+	WalkMeshes walkmeshes = (game_assets() ? WalkMeshes(*game_assets(), "plane.w") : WalkMeshes(data_path("plane.w")));
+	WalkMesh const &walkmesh = walkmeshes.lookup("WalkMesh.001");
+
+	#ifndef _WIN32
+	{ //each bot uses a few descriptors (TCP socket, UDP socket, epoll), so raise the open file limit as far as allowed:
+		struct rlimit limit;
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+	}
+	#endif
+
+	//connect all the bots (quietly; Client reports every connection attempt):
+	std::vector< std::unique_ptr< Bot > > bots;
+	bots.reserve(bot_count);
+	std::cout << "Connecting " << bot_count << " bots to " << host << ":" << port << "..." << std::endl;
+	std::cout.setstate(std::ios::failbit);
+	for (uint32_t i = 0; i < bot_count; ++i) {
+		try {
+			bots.emplace_back(std::make_unique< Bot >(host, port));
+			bots.back()->client.unreliable_shim = unreliable_shim;
+		} catch (std::exception const &e) {
+			std::cerr << "Bot " << i << " failed to connect: " << e.what() << std::endl;
+			break;
+		}
+	}
+	std::cout.clear();
+	std::cout << "Connected " << bots.size() << " bots; running for " << seconds << " seconds on " << thread_count << " thread(s)." << std::endl;
+	if (bots.empty()) return 1;
+
+	//------------ main loop ------------
+
+	double server_cpu_before = (server_pid > 0 ? process_cpu_seconds(server_pid) : -1.0);
+	auto start = Clock::now();
+	auto stop = start + std::chrono::duration< double >(seconds);
+
+	//each thread runs every thread_count'th bot:
+	std::vector< Stats > thread_stats(thread_count);
+	std::vector< std::thread > threads;
+	for (uint32_t t = 0; t < thread_count; ++t) {
+		threads.emplace_back([&, t](){
+			std::mt19937 mt(0x15466666 + t);
+			Stats &stats = thread_stats[t];
+			auto frame = std::chrono::duration_cast< Clock::duration >(std::chrono::duration< double >(1.0 / rate));
+			auto next_frame = Clock::now();
+			auto previous = next_frame;
+			while (next_frame < stop) {
+				std::this_thread::sleep_until(next_frame);
+				next_frame += frame;
+				auto now = Clock::now();
+				float elapsed = std::min(0.1f, std::chrono::duration< float >(now - previous).count());
+				previous = now;
+				for (size_t i = t; i < bots.size(); i += thread_count) {
+					update_bot(*bots[i], walkmesh, elapsed, mt, stats);
+				}
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	double elapsed = std::chrono::duration< double >(Clock::now() - start).count();
+	double server_cpu_after = (server_pid > 0 ? process_cpu_seconds(server_pid) : -1.0);
+
+	//------------ report ------------
+
+	Stats stats;
+	for (auto const &s : thread_stats) {
+		stats.merge(s);
+	}
+
+	size_t connected = std::count_if(bots.begin(), bots.end(), [](std::unique_ptr< Bot > const &bot){ return bool(bot->client.connection); });
+
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "bots: " << connected << " still connected of " << bots.size() << ", over " << elapsed << " s";
+	if (stats.malformed) std::cout << " (" << stats.malformed << " disconnected after malformed messages)";
+	std::cout << std::endl;
+	std::cout << "states: " << stats.states << " received (" << (double(stats.states) / elapsed / double(bots.size())) << "/s per bot; server ticks at " << (1.0f / Game::Tick) << "/s)" << std::endl;
+	std::cout << "tick jitter (ms):"
+	          << " p50 " << 1000.0f * percentile(stats.tick_jitter, 50.0f)
+	          << " p99 " << 1000.0f * percentile(stats.tick_jitter, 99.0f)
+	          << " p99.9 " << 1000.0f * percentile(stats.tick_jitter, 99.9f)
+	          << " max " << 1000.0f * percentile(stats.tick_jitter, 100.0f) << std::endl;
+	std::cout << "round trip (ms):"
+	          << " p50 " << 1000.0f * percentile(stats.round_trip, 50.0f)
+	          << " p90 " << 1000.0f * percentile(stats.round_trip, 90.0f)
+	          << " p99 " << 1000.0f * percentile(stats.round_trip, 99.0f)
+	          << " p99.9 " << 1000.0f * percentile(stats.round_trip, 99.9f)
+	          << " (" << stats.round_trip.size() << " samples; includes waiting for the next tick)" << std::endl;
+	std::cout << "bytes/sec: in " << (double(stats.bytes_in) / elapsed) << " (" << (double(stats.bytes_in) / elapsed / double(bots.size())) << " per bot),"
+	          << " out " << (double(stats.bytes_out) / elapsed) << " (" << (double(stats.bytes_out) / elapsed / double(bots.size())) << " per bot)" << std::endl;
+	if (server_cpu_before >= 0.0 && server_cpu_after >= 0.0) {
+		double cpu = server_cpu_after - server_cpu_before;
+		std::cout << "server CPU: " << (100.0 * cpu / elapsed) << "% of a core, "
+		          << (1e6 * cpu / elapsed / double(bots.size())) << " us/s per player" << std::endl;
+	} else if (server_pid > 0) {
+		std::cout << "server CPU: not available (couldn't read /proc/" << server_pid << "/stat)" << std::endl;
+	}
+
+	return 0;
+
+#ifdef _WIN32
+	} catch (std::exception const &e) {
+		std::cerr << "Unhandled exception:\n" << e.what() << std::endl;
+		return 1;
+	} catch (...) {
+		std::cerr << "Unhandled exception (unknown type)." << std::endl;
+		throw;
+	}
+#endif
+}
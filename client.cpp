@@ -14,6 +14,8 @@
 #include <stdexcept>
 #include <memory>
 #include <algorithm>
+#include <cstdlib>
+#include <string>
 
 #ifdef _WIN32
 extern "C" { uint32_t GetACP(); }
@@ -34,13 +36,36 @@ int main(int argc, char **argv) {
 	try {
 #endif
 	//------------ command line arguments ------------
-	if (argc != 3) {
-		std::cerr << "Usage:\n\t./client <host> <port>" << std::endl;
+	if (argc < 3) {
+		std::cerr << "Usage:\n\t./client <host> <port> [--interp-delay <seconds>] [--interp-linear] [--udp-loss <fraction>] [--udp-latency <seconds>] [--udp-jitter <seconds>]" << std::endl;
 		return 1;
 	}
 
+	//how remote players are smoothed (by default, with a delay that adapts to network jitter):
+	Interpolation::Config interpolation_config;
+
+	//(testing) simulate a lossy network on the unreliable channel:
+	UnreliableShim unreliable_shim;
+	for (int arg = 3; arg < argc; /*advanced below*/) {
+		if (std::string(argv[arg]) == "--interp-delay" && arg + 1 < argc) {
+			interpolation_config.delay = float(std::atof(argv[arg + 1]));
+			if (!(interpolation_config.delay >= 0.0f)) {
+				std::cerr << "Expecting a non-negative delay after '--interp-delay', got '" << argv[arg + 1] << "'." << std::endl;
+				return 1;
+			}
+			arg += 2;
+		} else if (std::string(argv[arg]) == "--interp-linear") {
+			interpolation_config.blend = Interpolation::Config::Blend::Linear;
+			arg += 1;
+		} else if (!unreliable_shim.parse_argument(argc, argv, &arg)) {
+			std::cerr << "Unrecognized argument '" << argv[arg] << "'." << std::endl;
+			return 1;
+		}
+	}
+
 	//------------ connect to server --------------
 	Client client(argv[1], argv[2]);
+	client.unreliable_shim = unreliable_shim;
 
 	//------------  initialization ------------
 
@@ -109,7 +134,7 @@ int main(int argc, char **argv) {
 	call_load_functions();
 
 	//------------ create game mode + make current --------------
-	Mode::set_current(std::make_shared< PlayMode >(client));
+	Mode::set_current(std::make_shared< PlayMode >(client, interpolation_config));
 
 	//------------ main loop ------------
 
@@ -0,0 +1,105 @@
+#include "count_neighbours.hpp"
+
+#ifdef COUNT_NEIGHBOURS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+//Every version works a row at a time; for output column x, the padded rows 'up', 'mid', and 'down'
+// hold the cell's column and its neighbours at x, x+1, and x+2.
+//Mine cells come out as -1 without a branch: with c the centre (0 or 1), (sum - c) | (0 - c) is either sum or all ones.
+
+//one row, columns [begin, width):
+static void count_row_scalar(uint8_t const *up, uint8_t const *mid, uint8_t const *down, uint32_t begin, uint32_t width, int8_t *out) {
+	for (uint32_t x = begin; x < width; ++x) {
+		uint8_t sum = uint8_t(up[x] + up[x+1] + up[x+2] + mid[x] + mid[x+1] + mid[x+2] + down[x] + down[x+1] + down[x+2]);
+		uint8_t centre = mid[x+1];
+		out[x] = int8_t(uint8_t(sum - centre) | uint8_t(0 - centre));
+	}
+}
+
+void count_neighbours_scalar(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride) {
+	size_t stride = size_t(width) + 2;
+	for (uint32_t y = 0; y < height; ++y) {
+		uint8_t const *up = mines + y * stride;
+		count_row_scalar(up, up + stride, up + 2 * stride, 0, width, counts + y * counts_stride);
+	}
+}
+
+#ifdef COUNT_NEIGHBOURS_X86
+
+void count_neighbours_sse2(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride) {
+	size_t stride = size_t(width) + 2;
+	for (uint32_t y = 0; y < height; ++y) {
+		uint8_t const *rows[3] = { mines + y * stride, mines + (y + 1) * stride, mines + (y + 2) * stride };
+		int8_t *out = counts + y * counts_stride;
+
+		uint32_t x = 0;
+		for (; x + 16 <= width; x += 16) {
+			__m128i sum = _mm_setzero_si128();
+			for (uint8_t const *row : rows) {
+				sum = _mm_add_epi8(sum, _mm_loadu_si128(reinterpret_cast< __m128i const * >(row + x)));
+				sum = _mm_add_epi8(sum, _mm_loadu_si128(reinterpret_cast< __m128i const * >(row + x + 1)));
+				sum = _mm_add_epi8(sum, _mm_loadu_si128(reinterpret_cast< __m128i const * >(row + x + 2)));
+			}
+			__m128i centre = _mm_loadu_si128(reinterpret_cast< __m128i const * >(rows[1] + x + 1));
+			__m128i value = _mm_or_si128(_mm_sub_epi8(sum, centre), _mm_sub_epi8(_mm_setzero_si128(), centre));
+			_mm_storeu_si128(reinterpret_cast< __m128i * >(out + x), value);
+		}
+		count_row_scalar(rows[0], rows[1], rows[2], x, width, out);
+	}
+}
+
+//AVX2 isn't part of the x86-64 baseline, so (outside of MSVC) this function is compiled for it specifically:
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+void count_neighbours_avx2(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride) {
+	size_t stride = size_t(width) + 2;
+	for (uint32_t y = 0; y < height; ++y) {
+		uint8_t const *rows[3] = { mines + y * stride, mines + (y + 1) * stride, mines + (y + 2) * stride };
+		int8_t *out = counts + y * counts_stride;
+
+		uint32_t x = 0;
+		for (; x + 32 <= width; x += 32) {
+			__m256i sum = _mm256_setzero_si256();
+			for (uint8_t const *row : rows) {
+				sum = _mm256_add_epi8(sum, _mm256_loadu_si256(reinterpret_cast< __m256i const * >(row + x)));
+				sum = _mm256_add_epi8(sum, _mm256_loadu_si256(reinterpret_cast< __m256i const * >(row + x + 1)));
+				sum = _mm256_add_epi8(sum, _mm256_loadu_si256(reinterpret_cast< __m256i const * >(row + x + 2)));
+			}
+			__m256i centre = _mm256_loadu_si256(reinterpret_cast< __m256i const * >(rows[1] + x + 1));
+			__m256i value = _mm256_or_si256(_mm256_sub_epi8(sum, centre), _mm256_sub_epi8(_mm256_setzero_si256(), centre));
+			_mm256_storeu_si256(reinterpret_cast< __m256i * >(out + x), value);
+		}
+		count_row_scalar(rows[0], rows[1], rows[2], x, width, out);
+	}
+}
+
+bool cpu_has_avx2() {
+	#ifdef _MSC_VER
+	//AVX2 supported by the CPU (leaf 7, ebx bit 5), and AVX state saved by the OS (OSXSAVE, then XCR0 bits 1-2):
+	int info[4];
+	__cpuid(info, 1);
+	if (!(info[2] & (1 << 27))) return false;
+	if ((_xgetbv(0) & 0x6) != 0x6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+	#else
+	return __builtin_cpu_supports("avx2");
+	#endif
+}
+
+#endif //COUNT_NEIGHBOURS_X86
+
+void count_neighbours(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride) {
+	#ifdef COUNT_NEIGHBOURS_X86
+	static const bool avx2 = cpu_has_avx2();
+	if (avx2) count_neighbours_avx2(mines, width, height, counts, counts_stride);
+	else count_neighbours_sse2(mines, width, height, counts, counts_stride);
+	#else
+	count_neighbours_scalar(mines, width, height, counts, counts_stride);
+	#endif
+}
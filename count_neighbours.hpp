@@ -0,0 +1,29 @@
+#pragma once
+
+/*
+ * count_neighbours computes minesweeper numbers for a grid of cells:
+ * each cell gets the count of mines in the eight cells around it (a 3x3 box sum minus the centre),
+ * or -1 if the cell is itself a mine.
+ *
+ *  'mines' is (width + 2) x (height + 2) bytes, row-major, each 0 or 1:
+ *     the grid itself with a one-cell border around it (holding mines from outside the grid, or zeros)
+ *  'counts' receives width x height values, row-major with rows 'counts_stride' bytes apart
+ *
+ * count_neighbours uses the fastest version the CPU supports;
+ * the specific versions are exposed for testing and benchmarking.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+void count_neighbours(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride);
+
+void count_neighbours_scalar(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride);
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define COUNT_NEIGHBOURS_X86
+void count_neighbours_sse2(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride);
+//(only call if cpu_has_avx2() is true)
+void count_neighbours_avx2(uint8_t const *mines, uint32_t width, uint32_t height, int8_t *counts, size_t counts_stride);
+bool cpu_has_avx2();
+#endif
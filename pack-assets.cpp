@@ -0,0 +1,77 @@
+//Asset packer: packs asset files (e.g., the contents of dist/) into one AssetPack (see AssetPack.hpp).
+// Files are stored whole, under their names without directories, e.g.:
+//   scenes/pack-assets dist/assets.pack dist/plane.pnct dist/plane.scene dist/plane.w
+
+#include "AssetPack.hpp"
+#include "read_write_chunk.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+int main(int argc, char **argv) {
+	if (argc < 3) {
+		std::cerr << "Usage:\n\t./pack-assets <output.pack> <file> [file ...]" << std::endl;
+		return 1;
+	}
+
+	try {
+		std::vector< AssetPack::TocEntry > toc;
+		std::vector< char > names;
+		std::vector< uint8_t > dat;
+		std::unordered_set< std::string > packed;
+
+		for (int arg = 2; arg < argc; ++arg) {
+			std::string filename = argv[arg];
+			std::string name = filename.substr(filename.find_last_of("/\\") + 1);
+			if (!packed.emplace(name).second) throw std::runtime_error("More than one file named '" + name + "'.");
+
+			MappedFile file(filename);
+
+			//each file starts at a multiple of Alignment:
+			dat.resize((dat.size() + AssetPack::Alignment - 1) / AssetPack::Alignment * AssetPack::Alignment, 0);
+			if (dat.size() + file.size > 0xffffffffu) throw std::runtime_error("Files are too large to pack together.");
+
+			AssetPack::TocEntry entry;
+			entry.name_begin = uint32_t(names.size());
+			names.insert(names.end(), name.begin(), name.end());
+			entry.name_end = uint32_t(names.size());
+			entry.offset = uint32_t(dat.size());
+			entry.size = uint32_t(file.size);
+			entry.checksum = crc32(file.data, file.size);
+			toc.emplace_back(entry);
+
+			if (file.size) dat.insert(dat.end(), file.data, file.data + file.size);
+			std::cout << "  " << name << " (" << file.size << " bytes)" << std::endl;
+		}
+
+		//zero-filled pad0 chunk, so dat0's data starts at a multiple of Alignment:
+		size_t before_pad = (8 + toc.size() * sizeof(AssetPack::TocEntry)) + (8 + names.size());
+		size_t unaligned = (before_pad + 8 + 8) % AssetPack::Alignment;
+		std::vector< uint8_t > pad((AssetPack::Alignment - unaligned) % AssetPack::Alignment, 0);
+
+		std::string output = argv[1];
+		std::ofstream out(output, std::ios::binary);
+		write_chunk("pak0", toc, &out);
+		write_chunk("str0", names, &out);
+		write_chunk("pad0", pad, &out);
+		write_chunk("dat0", dat, &out);
+		if (!out) throw std::runtime_error("Failed to write '" + output + "'.");
+		out.close();
+
+		//read it back, to check it:
+		AssetPack check(output);
+		for (auto const &entry : check.entries) {
+			check.lookup(entry.first);
+		}
+		std::cout << "Wrote " << toc.size() << " files to '" << output << "'." << std::endl;
+	} catch (std::exception &e) {
+		std::cerr << "Failed to pack assets: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
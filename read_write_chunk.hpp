@@ -1,9 +1,15 @@
 #pragma once
 
+#include "MappedFile.hpp"
+
 #include <iostream>
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -41,6 +47,77 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector< T > *
 }
 
 
+//read-only view of a chunk's array of T, as returned by ChunkReader:
+template< typename T >
+struct ChunkSpan {
+	T const *elements = nullptr;
+	size_t count = 0;
+
+	T const *data() const { return elements; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	T const *begin() const { return elements; }
+	T const *end() const { return elements + count; }
+	T const &operator[](size_t i) const { assert(i < count); return elements[i]; }
+};
+
+//reads chunks (same format as read_chunk) in order from memory -- a MappedFile, or an entry in one (see AssetPack.hpp) -- without copying:
+// spans point straight into that memory, so are valid while both it and the reader are alive
+// (chunks following an odd-sized chunk may not be aligned for their type; those get copied into aligned storage owned by the reader)
+struct ChunkReader {
+	explicit ChunkReader(MappedFile const &file) : ChunkReader(file.data, file.size, file.filename) { }
+	ChunkReader(uint8_t const *data_, size_t size_, std::string const &name_) : data(data_), size(size_), name(name_) { }
+
+	template< typename T >
+	ChunkSpan< T > read(std::string const &magic) {
+		static_assert(std::is_trivially_copyable< T >::value, "chunks hold plain data");
+		assert(magic.size() == 4);
+
+		if (size - offset < 8) {
+			throw std::runtime_error("Failed to read chunk header from '" + name + "'");
+		}
+		uint8_t const *header = data + offset;
+		if (std::memcmp(header, magic.data(), 4) != 0) {
+			throw std::runtime_error("Unexpected magic number in chunk in '" + name + "' (expected '" + magic + "')");
+		}
+		uint32_t chunk_size;
+		std::memcpy(&chunk_size, header + 4, 4);
+		if (chunk_size % sizeof(T) != 0) {
+			throw std::runtime_error("Size of chunk '" + magic + "' in '" + name + "' not divisible by element size");
+		}
+		if (size - offset - 8 < chunk_size) {
+			throw std::runtime_error("Chunk '" + magic + "' runs past the end of '" + name + "'");
+		}
+
+		ChunkSpan< T > span;
+		span.count = chunk_size / sizeof(T);
+		uint8_t const *begin = header + 8;
+		offset += 8 + chunk_size;
+		if (span.count == 0) return span;
+		if (reinterpret_cast< uintptr_t >(begin) % alignof(T) == 0) {
+			span.elements = reinterpret_cast< T const * >(begin);
+		} else {
+			static_assert(alignof(T) <= alignof(std::max_align_t), "chunk element alignment is supported by new");
+			realigned.emplace_back(std::make_unique< std::max_align_t[] >((chunk_size + sizeof(std::max_align_t) - 1) / sizeof(std::max_align_t)));
+			std::memcpy(realigned.back().get(), begin, chunk_size);
+			span.elements = reinterpret_cast< T const * >(realigned.back().get());
+		}
+		return span;
+	}
+
+	//has every byte been read?
+	bool at_end() const { return offset == size; }
+
+	uint8_t const *data;
+	size_t size;
+	std::string name; //(for error messages)
+	size_t offset = 0; //start of the next chunk
+
+	//aligned copies of misaligned chunks:
+	std::vector< std::unique_ptr< std::max_align_t[] > > realigned;
+};
+
+
 //helper function to write a chunk of data in the same format as read_chunk:
 template< typename T >
 void write_chunk(std::string const &magic, std::vector< T > const &from, std::ostream *to_) {
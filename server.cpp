@@ -4,12 +4,383 @@
 #include "hex_dump.hpp"
 
 #include "Game.hpp"
+#include "SPSCQueue.hpp"
+#include "Profile.hpp"
+#include "WalkMesh.hpp"
+#include "data_path.hpp"
+#include "AssetPack.hpp"
 
 #include <chrono>
 #include <stdexcept>
 #include <iostream>
 #include <cassert>
 #include <unordered_map>
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <deque>
+#include <random>
+
+//The server hosts many independent matches ("rooms"), each with its own Game.
+//A network thread owns all connections and matches incoming clients into rooms;
+// rooms are spread across a pool of simulation threads ("shards"), each ticking its own rooms.
+
+//players per room (Game has two start positions, one per role):
+static constexpr uint32_t RoomSize = 2;
+
+//messages passed between the network thread and the shards:
+
+//client -> game (decoded on the network thread):
+struct ClientEvent {
+	enum Type : uint8_t {
+		Joined,
+		Left,
+		Input,
+		Ack,
+	} type = Joined;
+	uint32_t client = 0; //network thread's id for the client's connection
+	uint32_t room = 0; //room the client is in
+	//(Input) inputs from a controls message that weren't already sent to the room, oldest first:
+	std::array< Player::Input, Player::MaxInputsPerMessage > inputs;
+	uint8_t input_count = 0;
+	uint32_t ack = 0; //(Ack)
+};
+
+//game -> client (serialized on a shard's thread):
+struct ClientState {
+	uint32_t client = 0;
+	Game::StateMessage message;
+};
+
+//queues are sized generously; if one does fill up:
+// - a shard wakes the network thread and waits for it (the network thread never waits on a shard, so always drains to_clients soon)
+// - the network thread holds joins/leaves until there is room, and drops inputs/acks (see run_network)
+static constexpr size_t QueueCapacity = 1 << 14;
+template< typename T >
+static void push_waiting(SPSCQueue< T > &queue, T &&value, Server &server) {
+	if (queue.try_push(std::move(value))) return;
+	server.wake();
+	while (!queue.try_push(std::move(value))) {
+		std::this_thread::yield();
+	}
+}
+
+//a simulation thread and the queues connecting it to the network thread:
+// (each queue has exactly one producer and one consumer)
+struct Shard {
+	Shard() : to_game(QueueCapacity), to_clients(QueueCapacity) { }
+	SPSCQueue< ClientEvent > to_game; //network thread -> shard
+	SPSCQueue< ClientState > to_clients; //shard -> network thread
+	std::thread thread;
+};
+
+//shard thread: apply client events to this shard's rooms, update every room exactly once per Game::Tick,
+// and hand each room's serialized state back to the network thread:
+// (players walk on 'walkmesh', which is shared read-only by all shards)
+// (each room's board is seeded from 'seed' and the room's id, so rooms get different mine layouts)
+// (the network thread sleeps in server.poll() until woken, so the shard wakes it once it has pushed the tick's state)
+static void run_shard(Shard &shard, uint32_t index, WalkMesh const &walkmesh, uint64_t seed, Server &server) {
+	Profile::register_thread("shard " + std::to_string(index));
+
+	struct Room {
+		explicit Room(Board::Config const &config) : game(config) { }
+		Game game;
+		//keep track of which client is controlling which player:
+		std::unordered_map< uint32_t, PlayerTable::Handle > client_to_player;
+	};
+	std::unordered_map< uint32_t, std::unique_ptr< Room > > rooms;
+
+	//scratch space for sending state:
+	std::vector< uint32_t > recipient_clients;
+	std::vector< PlayerTable::Handle > recipients;
+	std::vector< Game::StateMessage > messages;
+
+	auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
+	while (true) {
+		//wait for the tick (no socket work happens on this thread, so it can't be delayed by it):
+		std::this_thread::sleep_until(next_tick);
+		next_tick += std::chrono::duration< double >(Game::Tick);
+
+		//time everything done this tick:
+		Profile::Scope tick_scope(Profile::Tick);
+
+		//apply everything clients sent since the last tick:
+		ClientEvent event;
+		while (shard.to_game.try_pop(&event)) {
+			auto &room = rooms[event.room];
+			if (event.type == ClientEvent::Joined) {
+				//create the room on its first join, and some player info for the client:
+				if (!room) {
+					Board::Config config;
+					config.seed = seed ^ (uint64_t(event.room) * 0x9e3779b97f4a7c15ull); //(Board mixes this further per chunk)
+					room = std::make_unique< Room >(config);
+					room->game.walkmesh = &walkmesh;
+				}
+				room->client_to_player.emplace(event.client, room->game.spawn_player());
+				continue;
+			}
+			assert(room);
+			auto f = room->client_to_player.find(event.client);
+			assert(f != room->client_to_player.end());
+			if (event.type == ClientEvent::Left) {
+				room->game.remove_player(f->second);
+				room->client_to_player.erase(f);
+				if (room->client_to_player.empty()) rooms.erase(event.room);
+			} else if (event.type == ClientEvent::Input) {
+				for (uint32_t i = 0; i < event.input_count; ++i) {
+					room->game.queue_input(f->second, event.inputs[i]);
+				}
+			} else { assert(event.type == ClientEvent::Ack);
+				//acks can only move forward:
+				PlayerTable &players = room->game.players;
+				uint32_t &acked = players.acked_snapshot[players.index(f->second)];
+				acked = std::max(acked, event.ack);
+			}
+		}
+
+		{ //update current game state
+			Profile::Scope scope(Profile::Update);
+			for (auto &[id, room] : rooms) {
+				room->game.update(Game::Tick);
+			}
+		}
+
+		{ //send updated game state to each room's clients:
+			Profile::Scope scope(Profile::Serialize);
+			bool pushed = false;
+			for (auto &[id, room] : rooms) {
+				recipient_clients.clear();
+				recipients.clear();
+				for (auto const &[client, player] : room->client_to_player) {
+					recipient_clients.emplace_back(client);
+					recipients.emplace_back(player);
+				}
+				room->game.make_state_messages(recipients, &messages);
+				for (size_t i = 0; i < messages.size(); ++i) {
+					ClientState state;
+					state.client = recipient_clients[i];
+					state.message = std::move(messages[i]);
+					push_waiting(shard.to_clients, std::move(state), server);
+					pushed = true;
+				}
+			}
+			if (pushed) server.wake();
+		}
+
+		//work for this tick ran into the next tick's time:
+		if (std::chrono::steady_clock::now() > next_tick) Profile::count_overrun();
+	}
+}
+
+//the network thread waits in server.poll() until socket activity or a shard's wake():
+// (it only times out to print stats, or -- with joins/leaves held for a full shard queue -- to retry them soon)
+static constexpr double NetworkPollTimeout = 1.0;
+static constexpr double NetworkRetryInterval = 0.001;
+
+//network thread: accept clients, match them into rooms, decode their messages for the rooms' shards, and send the shards' state messages:
+//(also prints timing stats every stats_interval seconds, if stats_interval > 0)
+static void run_network(Server &server, std::vector< std::unique_ptr< Shard > > &shards, double stats_interval) {
+	Profile::register_thread("network");
+	auto next_stats = std::chrono::steady_clock::now() + std::chrono::duration< double >(stats_interval);
+
+	//keep track of which connection belongs to which client, and where that client is playing:
+	// (ids rather than pointers are passed to the shards, since a connection's address may be reused after it closes)
+	struct ClientInfo {
+		Connection *connection = nullptr;
+		uint32_t room = 0;
+		uint32_t forwarded_input = 0; //newest input seq sent to the room
+	};
+	std::unordered_map< Connection *, uint32_t > connection_to_client;
+	std::unordered_map< uint32_t, ClientInfo > clients;
+	uint32_t next_client = 1;
+
+	//matchmaking: each new client joins the room that has been waiting longest for players (a new room, or one someone left);
+	// if no room is waiting, a new room is opened:
+	struct RoomInfo {
+		uint32_t shard = 0;
+		uint32_t players = 0;
+	};
+	std::unordered_map< uint32_t, RoomInfo > rooms;
+	std::vector< uint32_t > shard_rooms(shards.size(), 0); //rooms on each shard
+	std::deque< uint32_t > open_rooms; //rooms with fewer than RoomSize players, longest-waiting first
+	uint32_t next_room = 1;
+
+	//the network thread never waits on a shard (the shard may itself be waiting for room in to_clients):
+	// - joins and leaves must all arrive, in order, so ones that don't fit are held until the shard catches up
+	// - inputs and acks are dropped instead (clients repeat unapplied inputs, and newer acks supersede older ones)
+	std::vector< std::deque< ClientEvent > > held(shards.size()); //joins/leaves waiting for room in each shard's to_game
+	uint64_t dropped_events = 0; //(since the last stats report)
+
+	//returns false if the event was dropped:
+	auto send_event = [&](ClientEvent &&event) {
+		uint32_t shard = rooms.at(event.room).shard;
+		if (held[shard].empty() && shards[shard]->to_game.try_push(std::move(event))) return true;
+		if (event.type == ClientEvent::Joined || event.type == ClientEvent::Left) {
+			held[shard].emplace_back(std::move(event));
+			return true;
+		}
+		dropped_events += 1;
+		return false;
+	};
+
+	while (true) {
+		if (stats_interval > 0.0 && std::chrono::steady_clock::now() >= next_stats) {
+			next_stats += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(stats_interval));
+			std::cout << "Timing over the last " << stats_interval << " seconds (" << clients.size() << " clients in " << rooms.size() << " rooms):\n" << Profile::report();
+			if (dropped_events) std::cout << "  (dropped " << dropped_events << " input/ack events for full shard queues)\n";
+			std::cout.flush();
+			dropped_events = 0;
+		}
+
+		//pass along joins/leaves held for full shard queues:
+		for (size_t s = 0; s < shards.size(); ++s) {
+			while (!held[s].empty() && shards[s]->to_game.try_push(std::move(held[s].front()))) {
+				held[s].pop_front();
+			}
+		}
+
+		//send state the shards have prepared since the last poll (the poll will flush it):
+		{
+			Profile::Scope scope(Profile::Send);
+			for (auto &shard : shards) {
+				ClientState state;
+				while (shard->to_clients.try_pop(&state)) {
+					auto f = clients.find(state.client);
+					if (f == clients.end()) continue; //client left after the state was made
+					Game::send_state_message(f->second.connection, state.message);
+				}
+			}
+		}
+
+		//helper used on client close (due to quit) and server close (due to error):
+		auto remove_connection = [&](Connection *c) {
+			auto f = connection_to_client.find(c);
+			assert(f != connection_to_client.end());
+			uint32_t client = f->second;
+			uint32_t room = clients.at(client).room;
+
+			ClientEvent event;
+			event.type = ClientEvent::Left;
+			event.client = client;
+			event.room = room;
+			send_event(std::move(event));
+
+			//close down the room once everyone has left:
+			RoomInfo &info = rooms.at(room);
+			assert(info.players > 0);
+			info.players -= 1;
+			if (info.players == 0) {
+				shard_rooms[info.shard] -= 1;
+				rooms.erase(room);
+				open_rooms.erase(std::find(open_rooms.begin(), open_rooms.end(), room));
+			} else if (info.players + 1 == RoomSize) {
+				//room was full; the next client to connect can take the empty place:
+				open_rooms.emplace_back(room);
+			}
+
+			clients.erase(client);
+			connection_to_client.erase(f);
+		};
+
+		double timeout = NetworkPollTimeout;
+		for (auto const &h : held) {
+			if (!h.empty()) timeout = NetworkRetryInterval;
+		}
+		if (stats_interval > 0.0) {
+			timeout = std::min(timeout, std::max(0.0, std::chrono::duration< double >(next_stats - std::chrono::steady_clock::now()).count()));
+		}
+
+		Profile::Scope poll_scope(Profile::Poll);
+		server.poll([&](Connection *c, Connection::Event evt){
+			if (evt == Connection::OnOpen) {
+				//client connected:
+
+				//find them a room, opening a new one on the least-busy shard if needed:
+				if (open_rooms.empty()) {
+					uint32_t opened = next_room++;
+					RoomInfo &info = rooms[opened];
+					info.shard = uint32_t(std::min_element(shard_rooms.begin(), shard_rooms.end()) - shard_rooms.begin());
+					shard_rooms[info.shard] += 1;
+					open_rooms.emplace_back(opened);
+				}
+				uint32_t room = open_rooms.front();
+				RoomInfo &info = rooms.at(room);
+				info.players += 1;
+				if (info.players == RoomSize) open_rooms.pop_front();
+
+				uint32_t client = next_client++;
+				connection_to_client.emplace(c, client);
+				ClientInfo &client_info = clients[client];
+				client_info.connection = c;
+				client_info.room = room;
+
+				//let the room's shard create some player info for them:
+				ClientEvent event;
+				event.type = ClientEvent::Joined;
+				event.client = client;
+				event.room = room;
+				send_event(std::move(event));
+
+			} else if (evt == Connection::OnClose) {
+				//client disconnected:
+
+				remove_connection(c);
+
+			} else { assert(evt == Connection::OnRecv);
+				//got data from client:
+				//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
+
+				//look up client:
+				auto f = connection_to_client.find(c);
+				assert(f != connection_to_client.end());
+				uint32_t client = f->second;
+				ClientInfo &client_info = clients.at(client);
+				uint32_t room = client_info.room;
+
+				//decode messages from client (into a scratch player; the room applies them at its next tick):
+				Player decoded;
+				try {
+					bool handled_message;
+					do {
+						handled_message = false;
+						if (decoded.recv_controls_message(c)) {
+							handled_message = true;
+							//each message repeats every input the client hasn't seen applied; send the room just the new ones:
+							ClientEvent event;
+							event.type = ClientEvent::Input;
+							event.client = client;
+							event.room = room;
+							for (Player::Input const &input : decoded.inputs) {
+								if (input.seq > client_info.forwarded_input) event.inputs[event.input_count++] = input;
+							}
+							if (event.input_count) {
+								uint32_t newest = event.inputs[event.input_count - 1].seq;
+								//(if the event is dropped, the client will send these inputs again)
+								if (send_event(std::move(event))) client_info.forwarded_input = newest;
+							}
+						}
+						if (decoded.recv_ack_message(c)) {
+							handled_message = true;
+							ClientEvent event;
+							event.type = ClientEvent::Ack;
+							event.client = client;
+							event.room = room;
+							event.ack = decoded.acked_snapshot;
+							send_event(std::move(event));
+						}
+						//TODO: extend for more message types as needed
+					} while (handled_message);
+				} catch (std::exception const &e) {
+					std::cout << "Disconnecting client:" << e.what() << std::endl;
+					c->close();
+					remove_connection(c);
+				}
+			}
+		}, timeout);
+	}
+}
 
 #ifdef _WIN32
 extern "C" { uint32_t GetACP(); }
@@ -32,90 +403,75 @@ int main(int argc, char **argv) {
 
 	//------------ argument parsing ------------
 
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	if (argc < 2) {
+		std::cerr << "Usage:\n\t./server <port> [--threads <count>] [--stats-interval <seconds>] [--seed <number>] [--udp-loss <fraction>] [--udp-latency <seconds>] [--udp-jitter <seconds>]" << std::endl;
 		return 1;
 	}
 
-	//------------ initialization ------------
-
-	Server server(argv[1]);
+	//simulation threads (by default, one per core not used by the network thread):
+	uint32_t shard_count = std::max(2u, std::thread::hardware_concurrency()) - 1; //(hardware_concurrency() may be 0 if unknown)
 
-	//------------ main loop ------------
+	//how often to print timing stats (0 to never print them):
+	double stats_interval = 10.0;
 
-	//keep track of which connection is controlling which player:
-	std::unordered_map< Connection *, Player * > connection_to_player;
-	//keep track of game state:
-	Game game;
+	//rooms' boards are seeded from this (random unless given, so that each run has new boards):
+	uint64_t seed = (uint64_t(std::random_device()()) << 32) | uint64_t(std::random_device()());
 
-	while (true) {
-		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
-		//process incoming data from clients until a tick has elapsed:
-		while (true) {
-			auto now = std::chrono::steady_clock::now();
-			double remain = std::chrono::duration< double >(next_tick - now).count();
-			if (remain < 0.0) {
-				next_tick += std::chrono::duration< double >(Game::Tick);
-				break;
+	//(testing) simulate a lossy network on the unreliable channel:
+	UnreliableShim unreliable_shim;
+	for (int arg = 2; arg < argc; /*advanced below*/) {
+		if (std::string(argv[arg]) == "--threads" && arg + 1 < argc) {
+			int count = std::atoi(argv[arg + 1]);
+			if (count < 1) {
+				std::cerr << "Expecting a positive thread count after '--threads', got '" << argv[arg + 1] << "'." << std::endl;
+				return 1;
 			}
+			shard_count = uint32_t(count);
+			arg += 2;
+		} else if (std::string(argv[arg]) == "--stats-interval" && arg + 1 < argc) {
+			stats_interval = std::atof(argv[arg + 1]);
+			if (!(stats_interval >= 0.0)) {
+				std::cerr << "Expecting a non-negative interval after '--stats-interval', got '" << argv[arg + 1] << "'." << std::endl;
+				return 1;
+			}
+			arg += 2;
+		} else if (std::string(argv[arg]) == "--seed" && arg + 1 < argc) {
+			seed = std::strtoull(argv[arg + 1], nullptr, 0);
+			arg += 2;
+		} else if (!unreliable_shim.parse_argument(argc, argv, &arg)) {
+			std::cerr << "Unrecognized argument '" << argv[arg] << "'." << std::endl;
+			return 1;
+		}
+	}
 
-			//helper used on client close (due to quit) and server close (due to error):
-			auto remove_connection = [&](Connection *c) {
-				auto f = connection_to_player.find(c);
-				assert(f != connection_to_player.end());
-				game.remove_player(f->second);
-				connection_to_player.erase(f);
-			};
-
-			server.poll([&](Connection *c, Connection::Event evt){
-				if (evt == Connection::OnOpen) {
-					//client connected:
-
-					//create some player info for them:
-					connection_to_player.emplace(c, game.spawn_player());
+	//------------ initialization ------------
 
-				} else if (evt == Connection::OnClose) {
-					//client disconnected:
+	//players walk on the same walkmesh as in the client:
+	WalkMeshes walkmeshes = (game_assets() ? WalkMeshes(*game_assets(), "plane.w") : WalkMeshes(data_path("plane.w")));
+	WalkMesh const &walkmesh = walkmeshes.lookup("WalkMesh.001");
 
-					remove_connection(c);
+	Server server(argv[1]);
+	server.unreliable_shim = unreliable_shim;
 
-				} else { assert(evt == Connection::OnRecv);
-					//got data from client:
-					//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
-
-					//look up in players list:
-					auto f = connection_to_player.find(c);
-					assert(f != connection_to_player.end());
-					Player &player = *f->second;
-
-					//handle messages from client:
-					try {
-						bool handled_message;
-						do {
-							handled_message = false;
-							if (player.recv_player_message(c)) handled_message = true;
-							//TODO: extend for more message types as needed
-						} while (handled_message);
-					} catch (std::exception const &e) {
-						std::cout << "Disconnecting client:" << e.what() << std::endl;
-						c->close();
-						remove_connection(c);
-					}
-				}
-			}, remain);
-		}
+	//------------ main loop ------------
 
-		//update current game state
-		game.update(Game::Tick);
+	std::cout << "Running rooms on " << shard_count << " simulation thread(s), with boards from seed " << seed << "." << std::endl;
+	std::vector< std::unique_ptr< Shard > > shards;
+	for (uint32_t i = 0; i < shard_count; ++i) {
+		shards.emplace_back(std::make_unique< Shard >());
+	}
+	for (uint32_t i = 0; i < shards.size(); ++i) {
+		Shard *s = shards[i].get();
+		s->thread = std::thread([s,i,&walkmesh,seed,&server](){ run_shard(*s, i, walkmesh, seed, server); });
+	}
 
-		//send updated game state to all clients
-		for (auto &[c, player] : connection_to_player) {
-			game.send_state_message(c, player);
-		}
+	//this (main) thread handles all network traffic:
+	run_network(server, shards, stats_interval);
 
+	for (auto &shard : shards) {
+		shard->thread.join();
 	}
 
-
 	return 0;
 
 #ifdef _WIN32